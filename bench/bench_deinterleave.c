@@ -0,0 +1,126 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "decode.h"
+#include "deinterleave/deinterleave.h"
+#include "protocol/cadu.h"
+#include "utils.h"
+
+#define SHORTOPTS "hn:r:s:"
+
+static double run(int8_t *out, int8_t *samples, int cadus);
+static double now();
+static void   print_usage(const char *pname);
+
+int
+main(int argc, char *argv[])
+{
+	int8_t *samples, *out;
+	int cadus, repeats, i, c;
+	long len, count;
+	unsigned seed;
+	double elapsed, best;
+
+	cadus = 256;
+	repeats = 3;
+	seed = 1;
+
+	while ((c = getopt(argc, argv, SHORTOPTS)) != -1) {
+		switch (c) {
+			case 'n':
+				cadus = atoi(optarg);
+				break;
+			case 'r':
+				repeats = atoi(optarg);
+				break;
+			case 's':
+				seed = atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv[0]);
+				return 0;
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	cadus = MAX(1, cadus);
+	repeats = MAX(1, repeats);
+	count = (long)cadus * CADU_SOFT_LEN;
+	len = INTER_SIZE(count) + INTER_MARKER_STRIDE;
+
+	samples = malloc(len);
+	out = malloc(CADU_SOFT_CHUNK);
+	if (!samples || !out) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+
+	/* The deinterleaver does not look at the samples, so random data is good
+	 * enough */
+	srand(seed);
+	for (i=0; i<len; i++) {
+		samples[i] = rand();
+	}
+
+	best = HUGE_VAL;
+	for (i=0; i<repeats; i++) {
+		elapsed = run(out, samples, cadus);
+		best = MIN(best, elapsed);
+	}
+
+	printf("%d CADUs, %ld samples\n", cadus, count);
+	printf("%10s %10s\n", "Msample/s", "ns/sample");
+	printf("%10.2f %10.2f\n", count / best * 1e-6, best * 1e9 / count);
+
+	free(samples);
+	free(out);
+	return 0;
+}
+
+/* Static functions {{{ */
+/* Deinterleave the whole buffer, CADU_SOFT_CHUNK samples at a time like the
+ * decoder does, returning the elapsed time */
+static double
+run(int8_t *out, int8_t *samples, int cadus)
+{
+	double start;
+	int i;
+
+	deinterleave_init();
+
+	start = now();
+	for (i=0; i<cadus * (int)(CADU_SOFT_LEN / CADU_SOFT_CHUNK); i++) {
+		const size_t num_samples = deinterleave_num_samples(CADU_SOFT_CHUNK);
+
+		deinterleave(out, samples, CADU_SOFT_CHUNK);
+		samples += num_samples;
+	}
+
+	return now() - start;
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+print_usage(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", pname);
+	fprintf(stderr,
+	        "   -n <count>  Number of CADUs to deinterleave (default: 256)\n"
+	        "   -r <count>  Number of runs, the fastest is reported (default: 3)\n"
+	        "   -s <seed>   Random seed (default: 1)\n"
+	        "   -h          Print this help screen\n"
+	        );
+}
+/* }}} */
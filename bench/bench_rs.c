@@ -0,0 +1,253 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "ecc/rs.h"
+#include "protocol/vcdu.h"
+#include "utils.h"
+
+#define SHORTOPTS "hn:r:s:"
+
+static void   gf_init();
+static uint8_t gf_mul(uint8_t x, uint8_t y);
+static void   encode(Vcdu *v);
+static void   add_errors(Vcdu *v, int errors);
+static double run(Vcdu *dst, const Vcdu *src, int vcdus);
+static double now();
+static void   print_usage(const char *pname);
+
+/* Error counts per block to measure */
+static const int _error_counts[] = {0, 1, 2, 4, 8, 12, 16, 17};
+
+/* Field tables and generator polynomial, used to build valid codewords. Kept
+ * separate from the decoder's own tables so that they can be checked against
+ * each other */
+static uint8_t _exp[2*RS_N];
+static uint8_t _log[RS_N+1];
+static uint8_t _genpoly[RS_T+1];
+
+int
+main(int argc, char *argv[])
+{
+	const uint32_t feature_levels[] = {0, CPU_AVX2, CPU_AVX2 | CPU_SSSE3};
+	const char *kernels[LEN(feature_levels)];
+	Vcdu *clean, *noisy, *out;
+	int vcdus, repeats, fixed, kernel_count, level, i, j, c;
+	unsigned seed;
+	double elapsed, best;
+
+	vcdus = 1024;
+	repeats = 3;
+	seed = 1;
+
+	while ((c = getopt(argc, argv, SHORTOPTS)) != -1) {
+		switch (c) {
+			case 'n':
+				vcdus = atoi(optarg);
+				break;
+			case 'r':
+				repeats = atoi(optarg);
+				break;
+			case 's':
+				seed = atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv[0]);
+				return 0;
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	vcdus = MAX(1, vcdus);
+	repeats = MAX(1, repeats);
+
+	clean = malloc(vcdus * sizeof(*clean));
+	noisy = malloc(vcdus * sizeof(*noisy));
+	out = malloc(vcdus * sizeof(*out));
+	if (!clean || !noisy || !out) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+
+	gf_init();
+	rs_init();
+
+	srand(seed);
+	for (i=0; i<vcdus; i++) {
+		for (j=0; j<(int)sizeof(Vcdu); j++) {
+			((uint8_t*)&clean[i])[j] = rand();
+		}
+		encode(&clean[i]);
+	}
+
+	printf("%d VCDUs, %d blocks\n", vcdus, INTERLEAVING * vcdus);
+	printf("%-16s %8s %12s %10s\n", "kernel", "errors", "us/block", "fixed");
+
+	/* Features cannot be re-enabled once disabled: go from the fastest
+	 * kernel to the slowest one, skipping the ones already benchmarked */
+	kernel_count = 0;
+	for (level=0; level<(int)LEN(feature_levels); level++) {
+		cpu_disable_features(feature_levels[level]);
+		rs_init();
+
+		for (i=0; i<kernel_count && strcmp(kernels[i], rs_kernel_name()); i++);
+		if (i < kernel_count) continue;
+		kernels[kernel_count++] = rs_kernel_name();
+
+		/* Same errors for every kernel */
+		srand(seed);
+		for (i=0; i<(int)LEN(_error_counts); i++) {
+			memcpy(noisy, clean, vcdus * sizeof(*clean));
+			for (j=0; j<vcdus; j++) {
+				add_errors(&noisy[j], _error_counts[i]);
+			}
+
+			best = HUGE_VAL;
+			for (j=0; j<repeats; j++) {
+				elapsed = run(out, noisy, vcdus);
+				best = MIN(best, elapsed);
+			}
+
+			/* Count the VCDUs that were restored to their original contents */
+			fixed = 0;
+			for (j=0; j<vcdus; j++) {
+				fixed += !memcmp(&out[j], &clean[j], sizeof(*out));
+			}
+
+			printf("%-16s %8d %12.3f %9.1f%%\n", rs_kernel_name(), _error_counts[i],
+			       best * 1e6 / (INTERLEAVING * vcdus), 100.0 * fixed / vcdus);
+		}
+	}
+
+	free(clean);
+	free(noisy);
+	free(out);
+	return 0;
+}
+
+/* Static functions {{{ */
+static void
+gf_init()
+{
+	int i, x, j, k;
+	uint8_t root;
+
+	x = 1;
+	for (i=0; i<RS_N; i++) {
+		_exp[i] = _exp[i + RS_N] = x;
+		_log[x] = i;
+		x <<= 1;
+		if (x > RS_N) x ^= GEN_POLY;
+	}
+
+	/* Product of (x - root) over the roots of the code */
+	_genpoly[0] = 1;
+	for (j=0; j<RS_T; j++) {
+		root = _exp[((j + FIRST_ROOT) * ROOT_SKIP) % RS_N];
+		_genpoly[j+1] = 0;
+		for (k=j+1; k>0; k--) {
+			_genpoly[k] = _genpoly[k-1] ^ gf_mul(_genpoly[k], root);
+		}
+		_genpoly[0] = gf_mul(_genpoly[0], root);
+	}
+}
+
+static uint8_t
+gf_mul(uint8_t x, uint8_t y)
+{
+	return x && y ? _exp[_log[x] + _log[y]] : 0;
+}
+
+/* Overwrite the check symbols of each block of a VCDU so that it becomes a
+ * valid codeword. The first byte of a block is the highest order coefficient */
+static void
+encode(Vcdu *v)
+{
+	uint8_t *const data = (uint8_t*)v;
+	uint8_t rem[RS_N], coeff;
+	int i, j, k;
+
+	for (i=0; i<INTERLEAVING; i++) {
+		for (j=0; j<RS_N; j++) {
+			rem[RS_N-1 - j] = j < RS_K ? data[j*INTERLEAVING + i] : 0;
+		}
+
+		/* The remainder of the division by the generator polynomial ends up
+		 * in the lowest RS_T coefficients */
+		for (k=RS_N-1; k>=RS_T; k--) {
+			coeff = rem[k];
+			for (j=0; j<=RS_T; j++) {
+				rem[k - RS_T + j] ^= gf_mul(coeff, _genpoly[j]);
+			}
+		}
+
+		for (j=RS_K; j<RS_N; j++) {
+			data[j*INTERLEAVING + i] = rem[RS_N-1 - j];
+		}
+	}
+}
+
+/* Corrupt the given number of distinct bytes in each block of a VCDU */
+static void
+add_errors(Vcdu *v, int errors)
+{
+	uint8_t *const data = (uint8_t*)v;
+	uint8_t hit[RS_N];
+	int i, j, pos;
+
+	for (i=0; i<INTERLEAVING; i++) {
+		memset(hit, 0, sizeof(hit));
+		for (j=0; j<errors; j++) {
+			do {
+				pos = rand() % RS_N;
+			} while (hit[pos]);
+			hit[pos] = 1;
+
+			data[pos*INTERLEAVING + i] ^= 1 + rand() % RS_N;
+		}
+	}
+}
+
+/* Error correct a copy of every VCDU, returning the elapsed time */
+static double
+run(Vcdu *dst, const Vcdu *src, int vcdus)
+{
+	double start;
+	int i;
+
+	memcpy(dst, src, vcdus * sizeof(*src));
+
+	start = now();
+	for (i=0; i<vcdus; i++) {
+		rs_fix(&dst[i]);
+	}
+
+	return now() - start;
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+print_usage(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", pname);
+	fprintf(stderr,
+	        "   -n <count>  Number of VCDUs per error count (default: 1024)\n"
+	        "   -r <count>  Number of runs, the fastest is reported (default: 3)\n"
+	        "   -s <seed>   Random seed (default: 1)\n"
+	        "   -h          Print this help screen\n"
+	        );
+}
+/* }}} */
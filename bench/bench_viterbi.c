@@ -0,0 +1,309 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "ecc/viterbi.h"
+#include "protocol/cadu.h"
+#include "utils.h"
+
+#define SHORTOPTS "e:hn:r:s:t:"
+#define AMPLITUDE 64            /* Soft symbol amplitude before adding noise */
+
+enum traceback { CHUNKED, BLOCK, BATCH, PARALLEL };
+
+static void   generate(uint8_t *data, int8_t *soft, int cadus, float ebn0, unsigned seed);
+static double run(enum traceback mode, uint8_t *out, int8_t *soft, int cadus, int threads);
+static long   count_errors(const uint8_t *out, const uint8_t *data, long len);
+static int    check_batch(const uint8_t *out, int8_t *soft, int cadus);
+static float  gaussian();
+static double now();
+static void   print_usage(const char *pname);
+
+static const char *_traceback_names[] = {"chunked", "block", "batch", "parallel"};
+
+int
+main(int argc, char *argv[])
+{
+	const uint32_t feature_levels[] = {0, CPU_AVX2, CPU_AVX2 | CPU_SSSE3};
+	const char *kernels[2][LEN(feature_levels) * 2];
+	int kernel_count[2];
+	uint8_t *data, *out;
+	int8_t *soft;
+	int cadus, repeats, threads, level, radix4, int8, mode, mismatches, i, c;
+	long bytes, errors, bits;
+	float ebn0;
+	unsigned seed;
+	double elapsed, best;
+
+	cadus = 256;
+	repeats = 3;
+	ebn0 = 4;
+	seed = 1;
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	mismatches = 0;
+
+	while ((c = getopt(argc, argv, SHORTOPTS)) != -1) {
+		switch (c) {
+			case 'e':
+				ebn0 = atof(optarg);
+				break;
+			case 'n':
+				cadus = atoi(optarg);
+				break;
+			case 'r':
+				repeats = atoi(optarg);
+				break;
+			case 's':
+				seed = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv[0]);
+				return 0;
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	/* Batch decoding splits the buffer into VITERBI_BATCH_LANES segments */
+	cadus = MAX(VITERBI_BATCH_LANES, cadus - cadus % VITERBI_BATCH_LANES);
+	repeats = MAX(1, repeats);
+	threads = MAX(1, threads);
+	bytes = (long)cadus * sizeof(Cadu);
+
+	data = malloc(bytes);
+	out = malloc(bytes);
+	soft = malloc(bytes * 16);
+	if (!data || !out || !soft) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+
+	printf("%d CADUs, Eb/N0 = %.1f dB, %d parallel threads\n", cadus, ebn0, threads);
+	generate(data, soft, cadus, ebn0, seed);
+
+	printf("%-16s %-6s %-9s %10s %10s %10s\n", "kernel", "metric", "traceback", "Mbit/s", "ns/bit", "BER");
+
+	/* Kernels are selected based on the CPU features and the radix-4 setting,
+	 * and features cannot be re-enabled once disabled: go from the fastest
+	 * kernels to the slowest ones, skipping combinations that select a kernel
+	 * that was already benchmarked */
+	kernel_count[0] = kernel_count[1] = 0;
+	for (level=0; level<(int)LEN(feature_levels); level++) {
+		for (radix4=1; radix4>=0; radix4--) {
+			cpu_disable_features(feature_levels[level]);
+			viterbi_set_radix4(radix4);
+			viterbi_init();
+
+			for (int8=0; int8<2; int8++) {
+				if (viterbi_set_int8(int8)) continue;
+
+				for (i=0; i<kernel_count[int8] && strcmp(kernels[int8][i], viterbi_kernel_name()); i++);
+				if (i < kernel_count[int8]) continue;
+				kernels[int8][kernel_count[int8]++] = viterbi_kernel_name();
+
+				for (mode=CHUNKED; mode<=PARALLEL; mode++) {
+					/* 8-bit metrics are only used by single-stream decoders */
+					if (int8 && (mode == BATCH || mode == PARALLEL)) continue;
+
+					best = HUGE_VAL;
+					for (i=0; i<repeats; i++) {
+						viterbi_init();
+						viterbi_set_int8(int8);
+						memset(out, 0, bytes);
+
+						elapsed = run(mode, out, soft, cadus, threads);
+						best = MIN(best, elapsed);
+					}
+
+					/* Batch segments are decoded independently, so they each
+					 * have their own VITERBI_DELAY bytes of latency */
+					if (mode == BATCH) {
+						if (check_batch(out, soft, cadus)) {
+							fprintf(stderr, "%s: batch output differs from single-stream decoding\n",
+							        viterbi_kernel_name());
+							mismatches++;
+						}
+
+						errors = 0;
+						for (i=0; i<VITERBI_BATCH_LANES; i++) {
+							errors += count_errors(out + i*bytes/VITERBI_BATCH_LANES,
+							                       data + i*bytes/VITERBI_BATCH_LANES,
+							                       bytes/VITERBI_BATCH_LANES);
+						}
+						bits = (bytes - VITERBI_BATCH_LANES*VITERBI_DELAY) * 8;
+					} else {
+						errors = count_errors(out, data, bytes);
+						bits = (bytes - VITERBI_DELAY) * 8;
+					}
+
+					printf("%-16s %-6s %-9s %10.2f %10.2f %10.2e\n",
+					       viterbi_kernel_name(), int8 ? "int8" : "int16", _traceback_names[mode],
+					       bytes * 8 / best * 1e-6, best * 1e9 / (bytes * 8),
+					       (double)errors / bits);
+				}
+			}
+		}
+	}
+
+	free(data);
+	free(out);
+	free(soft);
+	return mismatches ? 1 : 0;
+}
+
+/* Static functions {{{ */
+/* Generate random CADUs, convolutionally encode them and turn them into noisy
+ * soft symbols, laid out the way viterbi_decode() expects them */
+static void
+generate(uint8_t *data, int8_t *soft, int cadus, float ebn0, unsigned seed)
+{
+	const float sigma = AMPLITUDE / sqrtf(powf(10, ebn0 / 10));      /* Es/N0 = A^2/(2 sigma^2) = Eb/N0 / 2 */
+	uint64_t encoded;
+	uint32_t state, word;
+	long i;
+	int j;
+	float sample;
+
+	srand(seed);
+	state = 0;
+	for (i=0; i<(long)cadus * (long)sizeof(Cadu); i+=4) {
+		for (j=0; j<4; j++) {
+			data[i+j] = rand();
+		}
+		word = (uint32_t)data[i] << 24 | data[i+1] << 16 | data[i+2] << 8 | data[i+3];
+		state = conv_encode_u32(&encoded, state, word);
+
+		for (j=0; j<64; j++) {
+			sample = ((encoded >> (63-j)) & 1 ? -AMPLITUDE : AMPLITUDE) + sigma * gaussian();
+
+			/* -128 is not used, so that negating a symbol never overflows */
+			soft[16*i + (j^1)] = MAX(-127, MIN(127, lrintf(sample)));
+		}
+	}
+}
+
+/* Decode the whole buffer using the given method, returning the elapsed time */
+static double
+run(enum traceback mode, uint8_t *out, int8_t *soft, int cadus, int threads)
+{
+	const long bytes = (long)cadus * sizeof(Cadu);
+	uint8_t *outs[VITERBI_BATCH_LANES];
+	int8_t *ins[VITERBI_BATCH_LANES];
+	double start;
+	int i;
+
+	for (i=0; i<VITERBI_BATCH_LANES; i++) {
+		outs[i] = out + i*bytes/VITERBI_BATCH_LANES;
+		ins[i] = soft + 16*i*bytes/VITERBI_BATCH_LANES;
+	}
+
+	start = now();
+	switch (mode) {
+		case CHUNKED:
+			for (i=0; i<cadus; i++) {
+				viterbi_decode(out + i*sizeof(Cadu), soft + 16*i*sizeof(Cadu), sizeof(Cadu));
+			}
+			break;
+		case BLOCK:
+			/* The first traceback writes VITERBI_DELAY bytes less than the
+			 * others: offset the output to match the other modes */
+			out += VITERBI_DELAY;
+			for (i=0; i<cadus; i++) {
+				viterbi_decode_block(out, soft + 16*i*sizeof(Cadu), sizeof(Cadu));
+				out += i ? sizeof(Cadu) : sizeof(Cadu) - VITERBI_DELAY;
+			}
+			break;
+		case BATCH:
+			viterbi_decode_batch(outs, ins, NULL, VITERBI_BATCH_LANES, bytes/VITERBI_BATCH_LANES);
+			break;
+		case PARALLEL:
+			viterbi_decode_parallel(out, soft, bytes, threads, NULL);
+			break;
+	}
+
+	return now() - start;
+}
+
+/* Decode each batch segment with its own single-stream decoder, and check
+ * that the output matches what viterbi_decode_batch() wrote */
+static int
+check_batch(const uint8_t *out, int8_t *soft, int cadus)
+{
+	const long bytes = (long)cadus * sizeof(Cadu) / VITERBI_BATCH_LANES;
+	ViterbiDecoder *vit;
+	uint8_t *expected;
+	int i, mismatch;
+
+	expected = malloc(bytes);
+	if (!expected) return 1;
+
+	mismatch = 0;
+	for (i=0; i<VITERBI_BATCH_LANES && !mismatch; i++) {
+		if (!(vit = viterbi_decoder_init())) {
+			mismatch = 1;
+			break;
+		}
+		viterbi_decoder_decode(vit, expected, soft + 16*i*bytes, bytes);
+		mismatch = memcmp(expected, out + i*bytes, bytes) != 0;
+		viterbi_decoder_free(vit);
+	}
+
+	free(expected);
+	return mismatch;
+}
+
+/* Count bit errors, taking into account the VITERBI_DELAY bytes of latency of
+ * the decoder */
+static long
+count_errors(const uint8_t *out, const uint8_t *data, long len)
+{
+	long i, errors;
+
+	errors = 0;
+	for (i=0; i<len-VITERBI_DELAY; i++) {
+		errors += count_ones(out[i+VITERBI_DELAY] ^ data[i]);
+	}
+
+	return errors;
+}
+
+/* Standard normal random variable, via the Box-Muller transform */
+static float
+gaussian()
+{
+	const float u1 = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+	const float u2 = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+
+	return sqrtf(-2 * logf(u1)) * cosf(2 * M_PI * u2);
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+print_usage(const char *pname)
+{
+	fprintf(stderr, "Usage: %s [options]\n", pname);
+	fprintf(stderr,
+	        "   -e <EbN0>   Eb/N0 of the generated symbols, in dB (default: 4)\n"
+	        "   -n <count>  Number of CADUs to decode (default: 256)\n"
+	        "   -r <count>  Number of runs per kernel, the fastest is reported (default: 3)\n"
+	        "   -s <seed>   Random seed (default: 1)\n"
+	        "   -t <count>  Number of threads used by the parallel decoder (default: online CPUs)\n"
+	        "   -h          Print this help screen\n"
+	        );
+}
+/* }}} */
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include "accumulator.h"
+#include "correlator.h"
+
+struct _accumulator {
+	int period;
+	int position;       /* Position of the first symbol of the next buffer in the period */
+	int frames;         /* Buffers accumulated since the last reset */
+
+	int32_t *dots[CORR_BASE_ROTATIONS];     /* Accumulated dot products with each base rotation of the syncword */
+	int32_t *energy;    /* Accumulated magnitude of the symbols, for normalization */
+
+	int16_t *tmp_dots[CORR_BASE_ROTATIONS];
+};
+
+static void accumulate(int32_t *dst, const int16_t *src, int len);
+static inline int32_t best_dot(const SyncAccumulator *acc, int idx);
+static int normalize(const SyncAccumulator *acc, int idx);
+
+SyncAccumulator*
+accumulator_init(int period)
+{
+	SyncAccumulator *acc;
+	int i, failed;
+
+	if (!(acc = malloc(sizeof(*acc)))) return NULL;
+
+	acc->period = period;
+	acc->energy = malloc(sizeof(*acc->energy) * period);
+	failed = !acc->energy;
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		acc->dots[i] = malloc(sizeof(*acc->dots[i]) * period);
+		acc->tmp_dots[i] = malloc(sizeof(*acc->tmp_dots[i]) * period);
+		failed |= !acc->dots[i] || !acc->tmp_dots[i];
+	}
+
+	if (failed) {
+		accumulator_free(acc);
+		return NULL;
+	}
+
+	accumulator_reset(acc);
+	return acc;
+}
+
+void
+accumulator_reset(SyncAccumulator *acc)
+{
+	int i;
+
+	acc->position = 0;
+	acc->frames = 0;
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		memset(acc->dots[i], 0, sizeof(*acc->dots[i]) * acc->period);
+	}
+	memset(acc->energy, 0, sizeof(*acc->energy) * acc->period);
+}
+
+void
+accumulator_feed(SyncAccumulator *acc, int8_t *soft, int len)
+{
+	const int count = MIN(len - 64, acc->period);
+	const int wrap = MIN(count, acc->period - acc->position);
+	int i, idx, energy;
+
+	if (count <= 0) return;
+
+	correlate_soft_dots(acc->tmp_dots, soft, count);
+
+	/* Add the dot products to the ones of the same positions in the previous
+	 * periods, wrapping around at the end of the period */
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		accumulate(acc->dots[i] + acc->position, acc->tmp_dots[i], wrap);
+		accumulate(acc->dots[i], acc->tmp_dots[i] + wrap, count - wrap);
+	}
+
+	/* Sliding sum of the magnitudes of the 64 symbols at each offset */
+	energy = 0;
+	for (i=0; i<64; i++) {
+		energy += abs(MAX(-127, soft[i]));
+	}
+	idx = acc->position;
+	for (i=0; i<count; i++) {
+		acc->energy[idx] += energy;
+		energy += abs(MAX(-127, soft[i+64])) - abs(MAX(-127, soft[i]));
+		idx = idx + 1 < acc->period ? idx + 1 : 0;
+	}
+
+	acc->frames++;
+}
+
+int
+accumulator_best(SyncAccumulator *acc, enum phase *rotation, int *corr, int *runner_up)
+{
+	int i, idx, best_idx, dist, best_offset;
+	int dots[CORR_BASE_ROTATIONS];
+	int32_t dot, max_dot;
+
+	/* Go through the positions starting from the beginning of the last buffer,
+	 * so that ties are resolved in favor of the lowest offset */
+	max_dot = -1;
+	best_offset = 0;
+	idx = acc->position;
+	for (i=0; i<acc->period; i++) {
+		dot = best_dot(acc, idx);
+		if (dot > max_dot) {
+			max_dot = dot;
+			best_offset = i;
+		}
+
+		idx = idx + 1 < acc->period ? idx + 1 : 0;
+	}
+	best_idx = (acc->position + best_offset) % acc->period;
+
+	/* Same rotation priority and normalization as correlate_soft_near() */
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		dots[i] = acc->dots[i][best_idx];
+	}
+	*rotation = correlate_soft_rotation(dots);
+	*corr = normalize(acc, best_idx);
+
+	/* Look for the best correlation far enough from the peak not to be
+	 * affected by it */
+	*runner_up = 0;
+	for (idx=0; idx<acc->period; idx++) {
+		dist = idx > best_idx ? idx - best_idx : best_idx - idx;
+		if (MIN(dist, acc->period - dist) > 64) {
+			*runner_up = MAX(*runner_up, normalize(acc, idx));
+		}
+	}
+
+	return best_offset;
+}
+
+void
+accumulator_advance(SyncAccumulator *acc, int len)
+{
+	acc->position = (acc->position + len) % acc->period;
+}
+
+int
+accumulator_frames(SyncAccumulator *acc)
+{
+	return acc->frames;
+}
+
+void
+accumulator_free(SyncAccumulator *acc)
+{
+	int i;
+
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		free(acc->dots[i]);
+		free(acc->tmp_dots[i]);
+	}
+	free(acc->energy);
+	free(acc);
+}
+
+/* Static functions {{{ */
+/* Highest dot product at the given position, across all rotations */
+static inline int32_t
+best_dot(const SyncAccumulator *acc, int idx)
+{
+	int32_t best;
+	int i;
+
+	best = 0;
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		best = MAX(best, MAX(acc->dots[i][idx], -acc->dots[i][idx]));
+	}
+
+	return best;
+}
+
+/* Map the highest dot product at the given position to [0, 64], same as
+ * correlate_soft_near() */
+static int
+normalize(const SyncAccumulator *acc, int idx)
+{
+	const int64_t energy = acc->energy[idx];
+
+	return energy ? 32 * (energy + best_dot(acc, idx)) / energy : 0;
+}
+
+static void
+accumulate(int32_t *dst, const int16_t *src, int len)
+{
+	int i;
+
+	for (i=0; i<len; i++) {
+		dst[i] += src[i];
+	}
+}
+/* }}} */
@@ -0,0 +1,79 @@
+#ifndef accumulator_h
+#define accumulator_h
+
+#include <stdint.h>
+#include "utils.h"
+
+typedef struct _accumulator SyncAccumulator;
+
+/**
+ * Allocate a syncword accumulator. The accumulator adds up the soft-decision
+ * correlation of consecutive buffers at each position in the period of the
+ * syncword, so that a syncword that is too weak to be found in a single buffer
+ * can still be found after a few periods.
+ *
+ * @param period distance between two syncwords, in soft symbols
+ * @return pointer to the accumulator, or NULL on failure
+ */
+SyncAccumulator *accumulator_init(int period);
+
+/**
+ * Clear the correlations accumulated so far
+ *
+ * @param acc accumulator to reset
+ */
+void accumulator_reset(SyncAccumulator *acc);
+
+/**
+ * Add the correlation of a buffer of soft symbols at each offset to the
+ * accumulator. The first symbol of the buffer is assumed to immediately follow
+ * the last symbol consumed through accumulator_advance()
+ *
+ * @param acc accumulator to update
+ * @param soft pointer to the soft symbols
+ * @param len number of soft symbols in the buffer
+ */
+void accumulator_feed(SyncAccumulator *acc, int8_t *soft, int len);
+
+/**
+ * Find the syncword position with the highest accumulated correlation
+ *
+ * @param acc accumulator to use
+ * @param rotation the rotation to which the syncword correlates the best to.
+ *        Will only be written to by the function
+ * @param corr pointer to where the accumulated correlation at the returned
+ *        offset should be written to, on the same scale as correlate_near()
+ * @param runner_up pointer to where the highest accumulated correlation more
+ *        than 64 symbols away from the returned offset should be written to.
+ *        The difference with corr tells how much the syncword stands out
+ * @return the offset of the syncword, relative to the first symbol of the last
+ *         buffer passed to accumulator_feed()
+ */
+int  accumulator_best(SyncAccumulator *acc, enum phase *rotation, int *corr, int *runner_up);
+
+/**
+ * Mark a number of symbols as consumed, so that the next buffer passed to
+ * accumulator_feed() is aligned to the ones before it
+ *
+ * @param acc accumulator to update
+ * @param len number of symbols between the start of the last buffer and the
+ *        start of the next one
+ */
+void accumulator_advance(SyncAccumulator *acc, int len);
+
+/**
+ * Get the number of buffers accumulated since the last reset
+ *
+ * @param acc accumulator to use
+ * @return number of buffers passed to accumulator_feed()
+ */
+int  accumulator_frames(SyncAccumulator *acc);
+
+/**
+ * Free an accumulator allocated with accumulator_init()
+ *
+ * @param acc accumulator to free
+ */
+void accumulator_free(SyncAccumulator *acc);
+
+#endif /* accumulator_h */
@@ -1,78 +1,155 @@
-#include <stdio.h>
 #include <assert.h>
+#include <limits.h>
+#include <string.h>
 #include "autocorrelator.h"
 
-static const uint8_t _syncwords[] = {0x27, 0x4E, 0xD8, 0xB1};
+static void count_ones_by_position(int32_t *counts, const uint8_t *hard, const uint8_t *delayed, int period, int rows);
 
-int
-autocorrelate(enum phase *rotation, int period, uint8_t *restrict hard, int len)
+/* Marker rotated by 0, 90, 180 and 270 degrees, then the same with I and Q
+ * swapped */
+static const uint8_t _syncwords[] = {0x27, 0xB1, 0xD8, 0x4E, 0x1B, 0x8D, 0xE4, 0x72};
+
+/* Bits of each byte spread over the bytes of a 64-bit word, MSB first in the
+ * least significant byte */
+static uint64_t _spread[256];
+
+void
+autocorrelator_init(Autocorrelator *ac, int period)
 {
-	int i, j, k;
-	uint8_t tmp, xor, window;
-	int ones_count[8*period];
-	int average_bit[8*period];
-	int corr, best_corr, best_idx;
-
-	/* Make len a multiple of the period */
-	len -= len % period;
-
-	for (i=0; i<(int)LEN(ones_count); i++) {
-		ones_count[i] = 0;
-		average_bit[i] = 0;
-	}
+	int i, j;
 
-	/* XOR the bitstream with a delayed version of itself */
-	for (i=0; i<period; i++) {
-		j = len - period + i - 1;
-		tmp = hard[j];
-		for (j -= period; j >= 0; j -= period) {
-			xor = hard[j] ^ tmp;
-			tmp = hard[j];
-			hard[j] = xor;
-
-			/* Keep track of the average value of each bit in the period window */
-			for (k=0; k<8; k++) {
-				average_bit[8*i + 7-k] += tmp & (1<<k) ? 1 : -1;
-			}
+	assert(period <= AUTOCORR_MAX_PERIOD);
+
+	ac->period = 8*period;
+	autocorrelator_reset(ac);
+
+	for (i=0; i<256; i++) {
+		_spread[i] = 0;
+		for (j=0; j<8; j++) {
+			_spread[i] |= (uint64_t)((i >> (7-j)) & 0x1) << (8*j);
 		}
 	}
+}
 
+void
+autocorrelator_reset(Autocorrelator *ac)
+{
+	ac->phase = 0;
+	ac->best = -1;
+	ac->rows = 0;
+	memset(ac->diff, 0, sizeof(ac->diff));
+	memset(ac->balance, 0, sizeof(ac->balance));
+}
+
+int
+autocorrelate(Autocorrelator *ac, enum phase *rotation, const uint8_t *hard, int len)
+{
+	const int period = ac->period / 8;
+	const int rows = len / period;
+	int32_t diff[8*AUTOCORR_MAX_PERIOD], ones[8*AUTOCORR_MAX_PERIOD];
+	int i, j, t, corr, best_corr, best_offset, boost, dist, best_dist;
+	uint8_t marker;
+
+	/* Count, at each position in the period, the bits that differ from the
+	 * ones a period later and the bits that are set. The marker is where the
+	 * bits never change */
+	memset(diff, 0, sizeof(*diff) * ac->period);
+	memset(ones, 0, sizeof(*ones) * ac->period);
+	if (rows > 1) count_ones_by_position(diff, hard, hard + period, period, rows - 1);
+	count_ones_by_position(ones, hard, NULL, period, rows);
 
-	/* Find the bit offset with the most zeroes */
-	window = 0;
-	hard--;
-	for (i=0; i<8*(len-period); i++) {
-		if (!(i%8)) hard++;
-		window = (window >> 1) | ((*hard << (i%8)) & 0x80);
-		ones_count[i % (8*period)] += count_ones(window);
+	/* Halve the previous counts, and add the new ones at their position in the
+	 * period */
+	for (i=0; i<ac->period; i++) {
+		ac->diff[i] >>= 1;
+		ac->balance[i] /= 2;
 	}
+	for (i=0; i<ac->period; i++) {
+		j = (ac->phase + i) % ac->period;
+		ac->diff[j] += diff[i];
+		ac->balance[j] += 2*ones[i] - rows;
+	}
+	ac->rows = ac->rows/2 + rows;
+
+	/* Find the 8 bits with the fewest changes. Give the position found last
+	 * time a small boost, so that it only changes when another one is clearly
+	 * better */
+	boost = ac->rows * period / 64;
+	best_corr = INT_MAX;
+	best_offset = 0;
+	for (i=0; i<ac->period; i++) {
+		j = (ac->phase + i) % ac->period;
 
-	best_idx = 0;
-	best_corr = ones_count[0] - len/64;     /* Give offset 0 a small boost */
-	for (i=1; i<(int)LEN(ones_count); i++) {
-		if (ones_count[i] < best_corr) {
-			best_corr = ones_count[i];
-			best_idx = i;
+		corr = 0;
+		for (t=0; t<8; t++) {
+			corr += ac->diff[(j - t + ac->period) % ac->period];
+		}
+		if (j == ac->best) corr -= boost;
+
+		if (corr < best_corr) {
+			best_corr = corr;
+			best_offset = i;
 		}
 	}
+	ac->best = (ac->phase + best_offset) % ac->period;
 
-	/* Collect the average syncword bits */
-	tmp = 0;
-	for (i=7; i>=0; i--) {
-		tmp |= (average_bit[best_idx+i] > 0 ? 1<<i : 0);
+	/* Collect the average marker bits, and find the rotation they are closest to */
+	marker = 0;
+	for (t=7; t>=0; t--) {
+		marker = (marker << 1) | (ac->balance[(ac->best - t + ac->period) % ac->period] > 0);
 	}
 
-	/* Find the phase rotation of the syncword */
-	*rotation = 0;
-	best_corr = count_ones(tmp ^ _syncwords[0]);
+	*rotation = PHASE_0;
+	best_dist = count_ones(marker ^ _syncwords[0]);
 	for (i=1; i<(int)LEN(_syncwords); i++) {
-		corr = count_ones(tmp ^ _syncwords[i]);
-		if (best_corr > corr) {
-			best_corr = corr;
+		dist = count_ones(marker ^ _syncwords[i]);
+		if (dist < best_dist) {
+			best_dist = dist;
 			*rotation = i;
 		}
 	}
 
+	return best_offset;
+}
+
+void
+autocorrelator_advance(Autocorrelator *ac, int len)
+{
+	ac->phase = (ac->phase + len) % ac->period;
+}
+
+/* Static functions {{{ */
+/* Add the number of ones at each bit position of consecutive rows of period
+ * bytes to counts. If delayed is not NULL, the ones of each row XORed with the
+ * corresponding row of delayed are counted instead. The bits are spread into
+ * the 8 bytes of a 64-bit word, so that 8 positions are counted with a single
+ * addition */
+static void
+count_ones_by_position(int32_t *counts, const uint8_t *hard, const uint8_t *delayed, int period, int rows)
+{
+	uint64_t lanes[AUTOCORR_MAX_PERIOD];
+	int i, j, t, lane_rows;
+
+	memset(lanes, 0, sizeof(*lanes) * period);
+	lane_rows = 0;
+
+	for (i=0; i<rows; i++) {
+		for (j=0; j<period; j++) {
+			lanes[j] += _spread[delayed ? hard[j] ^ delayed[j] : hard[j]];
+		}
+		hard += period;
+		if (delayed) delayed += period;
 
-	return best_idx;
+		/* Move the counts out of the lanes before they overflow */
+		if (++lane_rows == UINT8_MAX || i == rows - 1) {
+			for (j=0; j<period; j++) {
+				for (t=0; t<8; t++) {
+					counts[8*j + t] += (lanes[j] >> (8*t)) & 0xFF;
+				}
+				lanes[j] = 0;
+			}
+			lane_rows = 0;
+		}
+	}
 }
+/* }}} */
@@ -4,18 +4,65 @@
 #include <stdint.h>
 #include "utils.h"
 
+#define AUTOCORR_MAX_PERIOD 16  /* Maximum distance between two synchronization
+                                   markers, in bytes */
+
+typedef struct {
+	int period;     /* Distance between two markers, in bits */
+	int phase;      /* Position of the next bit in the period */
+	int best;       /* Position of the end of the marker found last time, or -1 */
+	int rows;       /* Number of periods accumulated, decayed like the counters */
+
+	/* Number of bits at each position in the period that differ from the bit
+	 * one period later, and number of ones minus number of zeros at each
+	 * position. Both are halved every time a new buffer is added, so that
+	 * older buffers count less and less */
+	int32_t diff[8*AUTOCORR_MAX_PERIOD];
+	int32_t balance[8*AUTOCORR_MAX_PERIOD];
+} Autocorrelator;
+
+/**
+ * Initialize an autocorrelator
+ *
+ * @param ac autocorrelator to initialize
+ * @param period distance between two synchronization markers, in bytes. Must
+ *        be at most AUTOCORR_MAX_PERIOD
+ */
+void autocorrelator_init(Autocorrelator *ac, int period);
+
+/**
+ * Forget the correlations accumulated so far
+ *
+ * @param ac autocorrelator to reset
+ */
+void autocorrelator_reset(Autocorrelator *ac);
+
 /**
  * Correlate the given set of samples with a delayed copy of itself to find the
- * interleaving synchronization marker
+ * interleaving synchronization marker. The correlation is accumulated with the
+ * one of the previous buffers, so that only the new samples are processed.
+ * The first bit of the buffer is assumed to immediately follow the last bit
+ * passed to autocorrelator_advance()
  *
+ * @param ac autocorrelator to use
  * @param rotation the rotation to which the synchronization word correlates the
  *        best to. Will be only written to by the function
- * @param period distance between two synchronization markers
  * @param hard pointer to a byte buffer containing the hard samples to find the
  *        synchronization marker in
  * @param len length of the byte buffer, in bytes
- * @return the offset with the highest correlation to the syncword
+ * @return the offset of the last bit of the synchronization marker, relative to
+ *         the beginning of the buffer and modulo the period
+ */
+int  autocorrelate(Autocorrelator *ac, enum phase *rotation, const uint8_t *hard, int len);
+
+/**
+ * Mark a number of samples as consumed, so that the next buffer passed to
+ * autocorrelate() is aligned to the ones before it
+ *
+ * @param ac autocorrelator to update
+ * @param len number of samples between the start of the last buffer and the
+ *        start of the next one
  */
-int autocorrelate(enum phase *rotation, int period, uint8_t *restrict hard, int len);
+void autocorrelator_advance(Autocorrelator *ac, int len);
 
 #endif /* autocorrelator_h */
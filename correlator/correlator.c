@@ -1,27 +1,141 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "correlator.h"
+#include "cpu.h"
+#ifdef ARCH_NEON
+#include <arm_neon.h>
+#endif
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
 #include "ecc/viterbi.h"
 #include "utils.h"
 
-#define ROTATIONS 4
+#define ROTATIONS 8
+#define BLOCK_BYTES 8           /* Bytes per block of offsets in the vectorized
+                                   kernels, as 8 offsets are checked per byte */
+#define SOFT_BLOCK 64           /* Offsets per block in the vectorized
+                                   soft-decision kernels */
 
 static uint64_t hard_rotate_u64(uint64_t word, enum phase amount);
+static uint64_t swap_iq_u64(uint64_t word);
 static inline int correlate_u64(uint64_t x, uint64_t y);
+static inline int correlate_rotations(uint64_t window);
+static enum phase best_rotation(uint64_t window, int corr);
+static uint64_t read_window(const uint8_t *hard_cadu, int offset);
+static inline int search_body(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end);
+static int search_generic(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end);
+static int correlate_generic(int *restrict best_corr, uint8_t *restrict hard_cadu, int len);
+#ifdef ARCH_X86
+TARGET_POPCNT static int search_popcnt(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end);
+TARGET_POPCNT static int correlate_popcnt(int *restrict best_corr, uint8_t *restrict hard_cadu, int len);
+TARGET_AVX2 static int correlate_avx2(int *restrict best_corr, uint8_t *restrict hard_cadu, int len);
+#endif
+#ifdef ARCH_NEON
+TARGET_NEON static int correlate_neon(int *restrict best_corr, uint8_t *restrict hard_cadu, int len);
+#endif
+
+static inline int8_t clamp_soft(int8_t x);
+static inline void soft_dot(int *dots, const int8_t *soft);
+static inline int soft_best_dot(const int *dots);
+static inline int rotation_dot(const int *dots, enum phase phase);
+static int soft_energy(const int8_t *soft);
+static int soft_normalize(int dot, int energy);
+static int search_soft_generic(int *best_dot, int8_t *soft_cadu, int start, int end);
+static void soft_dots_generic(int16_t *const *dots, int8_t *soft_cadu, int count);
+#ifdef ARCH_X86
+TARGET_AVX2 static int search_soft_avx2(int *best_dot, int8_t *soft_cadu, int start, int end);
+TARGET_AVX2 static void soft_dots_avx2(int16_t *const *dots, int8_t *soft_cadu, int count);
+#endif
+#ifdef ARCH_NEON
+TARGET_NEON static int search_soft_neon(int *best_dot, int8_t *soft_cadu, int start, int end);
+TARGET_NEON static void soft_dots_neon(int16_t *const *dots, int8_t *soft_cadu, int count);
+#endif
 
 static uint64_t _syncwords[ROTATIONS];
 
+/* Rotations whose syncword is not the complement of another one. Adding 180
+ * degrees to them yields the other four */
+static const enum phase _base_rotations[CORR_BASE_ROTATIONS] = {PHASE_0, PHASE_90, PHASE_INV_0, PHASE_INV_90};
+
+/* Syncword as +-1 symbols, for each of the base rotations (the other four
+ * rotations are their opposites). A negative symbol corresponds to a 1 bit */
+static int8_t _soft_syncwords[CORR_BASE_ROTATIONS][64] __attribute__((aligned(32)));
+
+/* Correlation kernel, selected at runtime based on the CPU features. Returns
+ * the first offset with the highest correlation to any rotation of the
+ * syncword, and writes that correlation to best_corr */
+static int (*_correlate)(int *restrict best_corr, uint8_t *restrict hard_cadu, int len);
+static int (*_search)(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end);
+static const char *_kernel_name;
+
+/* Soft-decision correlation kernel. Returns the first offset in [start, end)
+ * with the highest absolute dot product with the 0 or 90 degrees syncword,
+ * and writes that dot product to best_dot */
+static int (*_search_soft)(int *best_dot, int8_t *soft_cadu, int start, int end);
+static void (*_soft_dots)(int16_t *const *dots, int8_t *soft_cadu, int count);
+static const char *_soft_kernel_name;
+
 void
 correlator_init(uint64_t syncword)
 {
-	int i;
+	int i, j;
 
+	/* The I/Q-swapped rotations are the rotations of the swapped syncword.
+	 * Both are then swapped again, since the symbol pairs come out of the
+	 * convolutional encoder in the opposite order */
 	for (i=0; i<ROTATIONS; i++) {
-		_syncwords[i] = hard_rotate_u64(syncword, i);
-		_syncwords[i] = ((_syncwords[i] & 0x5555555555555555) << 1)
-		              | ((_syncwords[i] & 0xAAAAAAAAAAAAAAAA) >> 1);
+		_syncwords[i] = hard_rotate_u64(i >= PHASE_INV_0 ? swap_iq_u64(syncword) : syncword, i);
+		_syncwords[i] = swap_iq_u64(_syncwords[i]);
+	}
+
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		for (j=0; j<64; j++) {
+			_soft_syncwords[i][j] = (_syncwords[_base_rotations[i]] >> (63-j)) & 0x1 ? -1 : 1;
+		}
+	}
+
+	/* Select the correlation kernel */
+	_correlate = correlate_generic;
+	_search = search_generic;
+	_kernel_name = "generic";
+#ifdef ARCH_NEON
+	if (cpu_features() & CPU_NEON) {
+		_correlate = correlate_neon;
+		_kernel_name = "neon";
+	}
+#endif
+#ifdef ARCH_X86
+	if (cpu_features() & CPU_POPCNT) {
+		_correlate = correlate_popcnt;
+		_search = search_popcnt;
+		_kernel_name = "popcnt";
+	}
+	if (cpu_features() & CPU_AVX2) {
+		_correlate = correlate_avx2;
+		_kernel_name = "avx2";
 	}
+#endif
+
+	_search_soft = search_soft_generic;
+	_soft_dots = soft_dots_generic;
+	_soft_kernel_name = "generic";
+#ifdef ARCH_NEON
+	if (cpu_features() & CPU_NEON) {
+		_search_soft = search_soft_neon;
+		_soft_dots = soft_dots_neon;
+		_soft_kernel_name = "neon";
+	}
+#endif
+#ifdef ARCH_X86
+	if (cpu_features() & CPU_AVX2) {
+		_search_soft = search_soft_avx2;
+		_soft_dots = soft_dots_avx2;
+		_soft_kernel_name = "avx2";
+	}
+#endif
 }
 
 
@@ -29,69 +143,602 @@ int
 correlate(enum phase *restrict best_phase, uint8_t *restrict hard_cadu, int len)
 {
 	enum phase phase;
-	int corr, best_corr, best_offset;
-	int i, j;
+	int best_corr, best_offset;
 	uint64_t window;
-	uint8_t tmp;
-
-	best_corr = 0;
-	best_offset = 0;
-	*best_phase = PHASE_0;
-
-	window = ((uint64_t)hard_cadu[0] << 56) |
-		((uint64_t)hard_cadu[1] << 48) |
-		((uint64_t)hard_cadu[2] << 40) |
-		((uint64_t)hard_cadu[3] << 32) |
-		((uint64_t)hard_cadu[4] << 24) |
-		((uint64_t)hard_cadu[5] << 16) |
-		((uint64_t)hard_cadu[6] << 8) |
-		((uint64_t)hard_cadu[7] << 0);
-	hard_cadu += 8;
 
 	/* Prioritize offset 0 */
-	for (phase=PHASE_0; phase<=PHASE_270; phase++) {
+	window = read_window(hard_cadu, 0);
+	for (phase=PHASE_0; phase<=PHASE_INV_270; phase++) {
 		if (correlate_u64(_syncwords[phase], window) > CORR_THR) {
 			*best_phase = phase;
 			return 0;
 		}
 	}
 
-	/* For each byte in the CADU */
-	for (i=0; i<len-8; i++) {
-		/* Fetch a byte from the CADU */
-		tmp = *hard_cadu++;
+	best_offset = _correlate(&best_corr, hard_cadu, len);
+	*best_phase = best_rotation(read_window(hard_cadu, best_offset), best_corr);
 
-		/* For each bit in the byte (can't do pairs because OQPSK symbols may be
-		 * offset by one rather than two) */
-		for (j=0; j<8; j++) {
-
-			/* Take all possible rotations of the syncword into account */
-			for (phase=PHASE_0; phase<=PHASE_270; phase++) {
-				corr = correlate_u64(_syncwords[phase], window);
-				if (corr > best_corr) {
-					best_corr = corr;
-					best_offset = i*8 + j;
-					*best_phase = phase;
+	return best_offset;
+}
+
+int
+correlate_near(enum phase *best_phase, int *best_corr, uint8_t *hard_cadu, int span)
+{
+	int best_offset;
+	uint64_t window;
+
+	/* Same as in correlate(), offset 0 is prioritized */
+	window = read_window(hard_cadu, 0);
+	*best_corr = correlate_rotations(window);
+	best_offset = 0;
+
+	if (*best_corr <= CORR_THR) {
+		best_offset = _search(best_corr, hard_cadu, 0, span);
+		window = read_window(hard_cadu, best_offset);
+	}
+
+	*best_phase = best_rotation(window, *best_corr);
+	return best_offset;
+}
+
+int
+correlate_soft(enum phase *best_phase, int8_t *soft_cadu, int len)
+{
+	enum phase phase;
+	int dots[CORR_BASE_ROTATIONS], energy, best_dot, best_offset;
+
+	/* Prioritize offset 0, same as correlate() */
+	soft_dot(dots, soft_cadu);
+	energy = soft_energy(soft_cadu);
+	for (phase=PHASE_0; phase<=PHASE_INV_270; phase++) {
+		if (soft_normalize(rotation_dot(dots, phase), energy) > CORR_THR) {
+			*best_phase = phase;
+			return 0;
+		}
+	}
+
+	best_offset = _search_soft(&best_dot, soft_cadu, 0, len-64);
+	soft_dot(dots, soft_cadu + best_offset);
+	*best_phase = correlate_soft_rotation(dots);
+
+	return best_offset;
+}
+
+int
+correlate_soft_near(enum phase *best_phase, int *best_corr, int8_t *soft_cadu, int span)
+{
+	int dots[CORR_BASE_ROTATIONS], best_dot, best_offset;
+
+	/* Same as in correlate(), offset 0 is prioritized */
+	best_offset = 0;
+	soft_dot(dots, soft_cadu);
+	*best_corr = soft_normalize(soft_best_dot(dots), soft_energy(soft_cadu));
+
+	if (*best_corr <= CORR_THR) {
+		best_offset = _search_soft(&best_dot, soft_cadu, 0, span);
+		soft_dot(dots, soft_cadu + best_offset);
+		*best_corr = soft_normalize(soft_best_dot(dots), soft_energy(soft_cadu + best_offset));
+	}
+
+	*best_phase = correlate_soft_rotation(dots);
+	return best_offset;
+}
+
+void
+correlate_soft_dots(int16_t *const *dots, int8_t *soft_cadu, int count)
+{
+	_soft_dots(dots, soft_cadu, count);
+}
+
+enum phase
+correlate_soft_rotation(const int *dots)
+{
+	const int best = soft_best_dot(dots);
+	enum phase phase;
+
+	for (phase=PHASE_0; phase<=PHASE_INV_270; phase++) {
+		if (rotation_dot(dots, phase) == best) {
+			return phase;
+		}
+	}
+
+	return PHASE_0;
+}
+
+const char*
+correlator_kernel_name()
+{
+	return _kernel_name;
+}
+
+const char*
+correlator_soft_kernel_name()
+{
+	return _soft_kernel_name;
+}
+
+
+/* Static functions {{{ */
+static int
+search_generic(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end)
+{
+	return search_body(best_corr, hard_cadu, start, end);
+}
+
+static int
+correlate_generic(int *restrict best_corr, uint8_t *restrict hard_cadu, int len)
+{
+	return search_body(best_corr, hard_cadu, 0, (len-8)*8);
+}
+
+#ifdef ARCH_X86
+TARGET_POPCNT static int
+search_popcnt(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end)
+{
+	/* Same code as the generic version, but with correlate_u64() compiled
+	 * down to a single popcnt instruction */
+	return search_body(best_corr, hard_cadu, start, end);
+}
+
+TARGET_POPCNT static int
+correlate_popcnt(int *restrict best_corr, uint8_t *restrict hard_cadu, int len)
+{
+	return search_body(best_corr, hard_cadu, 0, (len-8)*8);
+}
+
+/* Mismatching bits between each 64-bit lane of x and y, folded together with
+ * the ones of the complement of y. The result is in the lower 32 bits of each
+ * lane, the upper 32 bits are zero */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m256i
+correlate_rotations_avx2(__m256i x, __m256i y)
+{
+	const __m256i popcount_lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+	                                              0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+	const __m256i full = _mm256_set1_epi64x(64);
+	__m256i diff, count;
+
+	/* Nibble-wise popcount through a lookup table, then summed over each lane */
+	diff = _mm256_xor_si256(x, y);
+	count = _mm256_add_epi8(_mm256_shuffle_epi8(popcount_lut, _mm256_and_si256(diff, low_nibble)),
+	                        _mm256_shuffle_epi8(popcount_lut, _mm256_and_si256(_mm256_srli_epi16(diff, 4), low_nibble)));
+	count = _mm256_sad_epu8(count, _mm256_setzero_si256());
+
+	return _mm256_max_epi32(count, _mm256_sub_epi32(full, count));
+}
+
+TARGET_AVX2 static int
+correlate_avx2(int *restrict best_corr, uint8_t *restrict hard_cadu, int len)
+{
+	const __m256i shift_lo = _mm256_setr_epi64x(0, 1, 2, 3);
+	const __m256i shift_hi = _mm256_setr_epi64x(4, 5, 6, 7);
+	const __m256i shift_lo_next = _mm256_setr_epi64x(64, 63, 62, 61);
+	const __m256i shift_hi_next = _mm256_setr_epi64x(60, 59, 58, 57);
+	const __m256i sync = _mm256_set1_epi64x(_syncwords[PHASE_0]);
+	const __m256i sync_rot = _mm256_set1_epi64x(_syncwords[PHASE_90]);
+	const __m256i sync_inv = _mm256_set1_epi64x(_syncwords[PHASE_INV_0]);
+	const __m256i sync_inv_rot = _mm256_set1_epi64x(_syncwords[PHASE_INV_90]);
+	__m256i cur, next, window_lo, window_hi, block_corr;
+	uint64_t tmp;
+	int i, j, corr, block_best, best_block, best_offset, tail_corr, tail_offset;
+
+	block_best = 0;
+	best_block = -1;
+
+	/* Look for the block of 64 offsets containing the best correlation. Each
+	 * byte of the block yields the 8 windows starting in it, which are built
+	 * by shifting the 128 bits starting at that byte by 0..7 */
+	for (i=0; i + BLOCK_BYTES + 15 <= len; i += BLOCK_BYTES) {
+		block_corr = _mm256_setzero_si256();
+
+		for (j=i; j<i+BLOCK_BYTES; j++) {
+			memcpy(&tmp, hard_cadu + j, sizeof(tmp));
+			cur = _mm256_set1_epi64x(__builtin_bswap64(tmp));
+			memcpy(&tmp, hard_cadu + j + 8, sizeof(tmp));
+			next = _mm256_set1_epi64x(__builtin_bswap64(tmp));
+
+			window_lo = _mm256_or_si256(_mm256_sllv_epi64(cur, shift_lo), _mm256_srlv_epi64(next, shift_lo_next));
+			window_hi = _mm256_or_si256(_mm256_sllv_epi64(cur, shift_hi), _mm256_srlv_epi64(next, shift_hi_next));
+
+			/* The 180 and 270 degrees rotations are the complement of the 0
+			 * and 90 degrees ones, and are handled at the same time. Same
+			 * goes for the I/Q-swapped rotations */
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_lo, sync));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_lo, sync_rot));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_lo, sync_inv));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_lo, sync_inv_rot));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_hi, sync));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_hi, sync_rot));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_hi, sync_inv));
+			block_corr = _mm256_max_epi32(block_corr, correlate_rotations_avx2(window_hi, sync_inv_rot));
+		}
+
+		block_corr = _mm256_max_epi32(block_corr, _mm256_permute2x128_si256(block_corr, block_corr, 0x01));
+		block_corr = _mm256_max_epi32(block_corr, _mm256_shuffle_epi32(block_corr, 0x4E));
+		corr = _mm256_cvtsi256_si32(block_corr);
+
+		if (corr > block_best) {
+			block_best = corr;
+			best_block = i;
+		}
+	}
+
+	/* Find the exact offset inside the best block */
+	*best_corr = 0;
+	best_offset = 0;
+	if (best_block >= 0) {
+		best_offset = _search(best_corr, hard_cadu, best_block*8, (best_block + BLOCK_BYTES)*8);
+	}
+
+	/* Check the offsets that did not fit in a whole block */
+	if (i*8 < (len-8)*8) {
+		tail_offset = _search(&tail_corr, hard_cadu, i*8, (len-8)*8);
+		if (tail_corr > *best_corr) {
+			*best_corr = tail_corr;
+			best_offset = tail_offset;
+		}
+	}
+
+	return best_offset;
+}
+#endif
+
+#ifdef ARCH_NEON
+/* Same as correlate_rotations_avx2() */
+__attribute__((always_inline)) TARGET_NEON
+static inline uint32x4_t
+correlate_rotations_neon(uint64x2_t x, uint64x2_t y)
+{
+	const uint32x4_t full = vreinterpretq_u32_u64(vdupq_n_u64(64));
+	uint32x4_t count;
+
+	count = vreinterpretq_u32_u64(vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(vreinterpretq_u8_u64(veorq_u64(x, y)))))));
+	return vmaxq_u32(count, vsubq_u32(full, count));
+}
+
+TARGET_NEON static int
+correlate_neon(int *restrict best_corr, uint8_t *restrict hard_cadu, int len)
+{
+	const int64_t shifts[] = {0, 1, 2, 3, 4, 5, 6, 7};
+	const int64_t shifts_next[] = {-64, -63, -62, -61, -60, -59, -58, -57};
+	const uint64x2_t sync = vdupq_n_u64(_syncwords[PHASE_0]);
+	const uint64x2_t sync_rot = vdupq_n_u64(_syncwords[PHASE_90]);
+	const uint64x2_t sync_inv = vdupq_n_u64(_syncwords[PHASE_INV_0]);
+	const uint64x2_t sync_inv_rot = vdupq_n_u64(_syncwords[PHASE_INV_90]);
+	uint64x2_t cur, next, window;
+	uint32x4_t block_corr;
+	uint32x2_t tmp_corr;
+	uint64_t tmp;
+	int i, j, k, corr, block_best, best_block, best_offset, tail_corr, tail_offset;
+
+	block_best = 0;
+	best_block = -1;
+
+	/* Same algorithm as correlate_avx2(), two windows at a time */
+	for (i=0; i + BLOCK_BYTES + 15 <= len; i += BLOCK_BYTES) {
+		block_corr = vdupq_n_u32(0);
+
+		for (j=i; j<i+BLOCK_BYTES; j++) {
+			memcpy(&tmp, hard_cadu + j, sizeof(tmp));
+			cur = vdupq_n_u64(__builtin_bswap64(tmp));
+			memcpy(&tmp, hard_cadu + j + 8, sizeof(tmp));
+			next = vdupq_n_u64(__builtin_bswap64(tmp));
+
+			for (k=0; k<8; k+=2) {
+				/* Negative shifts are right shifts, and shifting by 64 yields 0 */
+				window = vorrq_u64(vshlq_u64(cur, vld1q_s64(shifts + k)), vshlq_u64(next, vld1q_s64(shifts_next + k)));
+				block_corr = vmaxq_u32(block_corr, correlate_rotations_neon(window, sync));
+				block_corr = vmaxq_u32(block_corr, correlate_rotations_neon(window, sync_rot));
+				block_corr = vmaxq_u32(block_corr, correlate_rotations_neon(window, sync_inv));
+				block_corr = vmaxq_u32(block_corr, correlate_rotations_neon(window, sync_inv_rot));
+			}
+		}
+
+		tmp_corr = vpmax_u32(vget_low_u32(block_corr), vget_high_u32(block_corr));
+		tmp_corr = vpmax_u32(tmp_corr, tmp_corr);
+		corr = vget_lane_u32(tmp_corr, 0);
+
+		if (corr > block_best) {
+			block_best = corr;
+			best_block = i;
+		}
+	}
+
+	*best_corr = 0;
+	best_offset = 0;
+	if (best_block >= 0) {
+		best_offset = _search(best_corr, hard_cadu, best_block*8, (best_block + BLOCK_BYTES)*8);
+	}
+
+	if (i*8 < (len-8)*8) {
+		tail_offset = _search(&tail_corr, hard_cadu, i*8, (len-8)*8);
+		if (tail_corr > *best_corr) {
+			*best_corr = tail_corr;
+			best_offset = tail_offset;
+		}
+	}
+
+	return best_offset;
+}
+#endif
+
+static int
+search_soft_generic(int *best_dot, int8_t *soft_cadu, int start, int end)
+{
+	int i, dots[CORR_BASE_ROTATIONS], dot, best_offset;
+
+	*best_dot = 0;
+	best_offset = start;
+
+	for (i=start; i<end; i++) {
+		soft_dot(dots, soft_cadu + i);
+		dot = soft_best_dot(dots);
+
+		if (dot > *best_dot) {
+			*best_dot = dot;
+			best_offset = i;
+		}
+	}
+
+	return best_offset;
+}
+
+static void
+soft_dots_generic(int16_t *const *dots, int8_t *soft_cadu, int count)
+{
+	int i, j, tmp[CORR_BASE_ROTATIONS];
+
+	for (i=0; i<count; i++) {
+		soft_dot(tmp, soft_cadu + i);
+		for (j=0; j<CORR_BASE_ROTATIONS; j++) {
+			dots[j][i] = tmp[j];
+		}
+	}
+}
+
+#ifdef ARCH_X86
+/* Sum the 16 products of the soft symbols with the syncword in the given base
+ * rotation, pairwise adding them into 16-bit lanes */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m256i
+soft_dot_avx2(const int8_t *soft, int rotation)
+{
+	const __m256i ones = _mm256_set1_epi8(1);
+	const __m256i min_val = _mm256_set1_epi8(-127);
+	__m256i lo, hi;
+
+	lo = _mm256_max_epi8(_mm256_loadu_si256((__m256i*)soft), min_val);
+	hi = _mm256_max_epi8(_mm256_loadu_si256((__m256i*)(soft + 32)), min_val);
+
+	return _mm256_add_epi16(_mm256_maddubs_epi16(ones, _mm256_sign_epi8(lo, _mm256_load_si256((__m256i*)&_soft_syncwords[rotation][0]))),
+	                        _mm256_maddubs_epi16(ones, _mm256_sign_epi8(hi, _mm256_load_si256((__m256i*)&_soft_syncwords[rotation][32]))));
+}
+
+/* Horizontally add each of 8 vectors, returning the 8 sums in a 128-bit vector */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m128i
+hsum8_avx2(const __m256i *x)
+{
+	__m256i sum;
+
+	sum = _mm256_hadd_epi16(_mm256_hadd_epi16(_mm256_hadd_epi16(x[0], x[1]), _mm256_hadd_epi16(x[2], x[3])),
+	                        _mm256_hadd_epi16(_mm256_hadd_epi16(x[4], x[5]), _mm256_hadd_epi16(x[6], x[7])));
+
+	return _mm_add_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+}
+
+TARGET_AVX2 static int
+search_soft_avx2(int *best_dot, int8_t *soft_cadu, int start, int end)
+{
+	__m256i dots[8];
+	__m128i block_dot;
+	int i, j, k, r, dot, block_best, best_block, best_offset, tail_dot, tail_offset;
+
+	block_best = 0;
+	best_block = -1;
+
+	/* Look for the block of offsets containing the highest dot product, 8
+	 * offsets at a time. The exact offset is then found with the generic
+	 * code, same as in correlate_avx2() */
+	for (i=start; i + SOFT_BLOCK <= end; i += SOFT_BLOCK) {
+		block_dot = _mm_setzero_si128();
+
+		for (j=i; j<i+SOFT_BLOCK; j+=8) {
+			for (r=0; r<CORR_BASE_ROTATIONS; r++) {
+				for (k=0; k<8; k++) {
+					dots[k] = soft_dot_avx2(soft_cadu + j + k, r);
 				}
+				block_dot = _mm_max_epi16(block_dot, _mm_abs_epi16(hsum8_avx2(dots)));
 			}
+		}
+
+		block_dot = _mm_max_epi16(block_dot, _mm_shuffle_epi32(block_dot, 0x4E));
+		block_dot = _mm_max_epi16(block_dot, _mm_shuffle_epi32(block_dot, 0xB1));
+		block_dot = _mm_max_epi16(block_dot, _mm_srli_epi32(block_dot, 16));
+		dot = _mm_extract_epi16(block_dot, 0);
+
+		if (dot > block_best) {
+			block_best = dot;
+			best_block = i;
+		}
+	}
+
+	*best_dot = 0;
+	best_offset = start;
+	if (best_block >= 0) {
+		best_offset = search_soft_generic(best_dot, soft_cadu, best_block, best_block + SOFT_BLOCK);
+	}
 
-			/* Advance window by one */
-			window = (window << 1) | ((tmp >> (7-j)) & 0x1);
+	if (i < end) {
+		tail_offset = search_soft_generic(&tail_dot, soft_cadu, i, end);
+		if (tail_dot > *best_dot) {
+			*best_dot = tail_dot;
+			best_offset = tail_offset;
 		}
 	}
 
 	return best_offset;
 }
 
+TARGET_AVX2 static void
+soft_dots_avx2(int16_t *const *dots, int8_t *soft_cadu, int count)
+{
+	__m256i partial[8];
+	int16_t *tail[CORR_BASE_ROTATIONS];
+	int i, k, r;
+
+	for (i=0; i+8 <= count; i+=8) {
+		for (r=0; r<CORR_BASE_ROTATIONS; r++) {
+			for (k=0; k<8; k++) {
+				partial[k] = soft_dot_avx2(soft_cadu + i + k, r);
+			}
+			_mm_storeu_si128((__m128i*)(dots[r] + i), hsum8_avx2(partial));
+		}
+	}
+
+	for (r=0; r<CORR_BASE_ROTATIONS; r++) {
+		tail[r] = dots[r] + i;
+	}
+	soft_dots_generic(tail, soft_cadu + i, count - i);
+}
+#endif
+
+#ifdef ARCH_NEON
+/* Dot product of 64 soft symbols with a syncword */
+__attribute__((always_inline)) TARGET_NEON
+static inline int
+soft_dot_neon(const int8x16_t *soft, const int8_t *syncword)
+{
+	int16x8_t sum;
+	int64x2_t total;
+
+	sum = vpaddlq_s8(vmulq_s8(soft[0], vld1q_s8(syncword)));
+	sum = vpadalq_s8(sum, vmulq_s8(soft[1], vld1q_s8(syncword + 16)));
+	sum = vpadalq_s8(sum, vmulq_s8(soft[2], vld1q_s8(syncword + 32)));
+	sum = vpadalq_s8(sum, vmulq_s8(soft[3], vld1q_s8(syncword + 48)));
+	total = vpaddlq_s32(vpaddlq_s16(sum));
+
+	return vgetq_lane_s64(total, 0) + vgetq_lane_s64(total, 1);
+}
+
+TARGET_NEON static int
+search_soft_neon(int *best_dot, int8_t *soft_cadu, int start, int end)
+{
+	const int8x16_t min_val = vdupq_n_s8(-127);
+	int8x16_t soft[4];
+	int i, j, dots[CORR_BASE_ROTATIONS], dot, best_offset;
+
+	*best_dot = 0;
+	best_offset = start;
+
+	for (i=start; i<end; i++) {
+		for (j=0; j<4; j++) {
+			soft[j] = vmaxq_s8(vld1q_s8(soft_cadu + i + 16*j), min_val);
+		}
+		for (j=0; j<CORR_BASE_ROTATIONS; j++) {
+			dots[j] = soft_dot_neon(soft, _soft_syncwords[j]);
+		}
+		dot = soft_best_dot(dots);
+
+		if (dot > *best_dot) {
+			*best_dot = dot;
+			best_offset = i;
+		}
+	}
+
+	return best_offset;
+}
+
+TARGET_NEON static void
+soft_dots_neon(int16_t *const *dots, int8_t *soft_cadu, int count)
+{
+	const int8x16_t min_val = vdupq_n_s8(-127);
+	int8x16_t soft[4];
+	int i, j;
+
+	for (i=0; i<count; i++) {
+		for (j=0; j<4; j++) {
+			soft[j] = vmaxq_s8(vld1q_s8(soft_cadu + i + 16*j), min_val);
+		}
+		for (j=0; j<CORR_BASE_ROTATIONS; j++) {
+			dots[j][i] = soft_dot_neon(soft, _soft_syncwords[j]);
+		}
+	}
+}
+#endif
+
+/* Look for the first offset in [start, end) with the highest correlation to
+ * any rotation of the syncword */
+__attribute__((always_inline))
+static inline int
+search_body(int *restrict best_corr, uint8_t *restrict hard_cadu, int start, int end)
+{
+	int i, corr, best_offset;
+	uint64_t window;
+
+	*best_corr = 0;
+	best_offset = start;
+
+	window = read_window(hard_cadu, start);
+	for (i=start; i<end; i++) {
+		corr = correlate_rotations(window);
+		if (corr > *best_corr) {
+			*best_corr = corr;
+			best_offset = i;
+		}
+
+		/* Advance window by one (can't do pairs because OQPSK symbols may be
+		 * offset by one rather than two) */
+		window = (window << 1) | ((hard_cadu[(i+64)/8] >> (7 - (i+64)%8)) & 0x1);
+	}
+
+	return best_offset;
+}
+
+/* Read the 64 bits starting at the given bit offset */
+static uint64_t
+read_window(const uint8_t *hard_cadu, int offset)
+{
+	uint64_t window;
+	int i;
+
+	hard_cadu += offset/8;
+	offset %= 8;
+
+	window = 0;
+	for (i=0; i<8; i++) {
+		window = (window << 8) | hard_cadu[i];
+	}
+	if (offset) {
+		window = (window << offset) | (hard_cadu[8] >> (8 - offset));
+	}
+
+	return window;
+}
+
+/* Get the first rotation of the syncword with the given correlation to window */
+static enum phase
+best_rotation(uint64_t window, int corr)
+{
+	enum phase phase;
+
+	for (phase=PHASE_0; phase<=PHASE_INV_270; phase++) {
+		if (correlate_u64(_syncwords[phase], window) == corr) {
+			return phase;
+		}
+	}
+
+	return PHASE_0;
+}
 
-/* Static functions {{{ */
 static uint64_t
 hard_rotate_u64(uint64_t word, enum phase amount)
 {
 	const uint64_t i = word & 0xaaaaaaaaaaaaaaaa;
 	const uint64_t q = word & 0x5555555555555555;
 
-	switch (amount) {
+	switch (amount & 0x3) {
 		case PHASE_0:
 			break;
 		case PHASE_90:
@@ -110,16 +757,108 @@ hard_rotate_u64(uint64_t word, enum phase amount)
 	return word;
 }
 
+/* Swap the two bits of each symbol pair */
+static uint64_t
+swap_iq_u64(uint64_t word)
+{
+	return ((word & 0x5555555555555555) << 1) | ((word & 0xAAAAAAAAAAAAAAAA) >> 1);
+}
+
+__attribute__((always_inline))
 static inline int
 correlate_u64(uint64_t x, uint64_t y)
 {
-	int corr;
-	uint64_t v = x ^ y;
+	return 64 - __builtin_popcountll(x ^ y);
+}
+
+/* Dot products of 64 soft symbols with the syncword in each of the base
+ * rotations */
+__attribute__((always_inline))
+static inline void
+soft_dot(int *dots, const int8_t *soft)
+{
+	int i, j;
+
+	for (j=0; j<CORR_BASE_ROTATIONS; j++) {
+		dots[j] = 0;
+		for (i=0; i<64; i++) {
+			dots[j] += clamp_soft(soft[i]) * _soft_syncwords[j][i];
+		}
+	}
+}
+
+/* Highest dot product across all rotations, given the base ones */
+__attribute__((always_inline))
+static inline int
+soft_best_dot(const int *dots)
+{
+	int i, best;
+
+	best = 0;
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		best = MAX(best, MAX(dots[i], -dots[i]));
+	}
+
+	return best;
+}
+
+/* Dot product with the syncword in the given rotation, given the base ones */
+__attribute__((always_inline))
+static inline int
+rotation_dot(const int *dots, enum phase phase)
+{
+	const int dot = dots[(phase & 0x1) | (phase & 0x4) >> 1];
+
+	return phase & 0x2 ? -dot : dot;
+}
+
+/* Sum of the magnitudes of 64 soft symbols, i.e. the highest dot product that
+ * they can have with any syncword */
+static int
+soft_energy(const int8_t *soft)
+{
+	int i, energy;
+
+	energy = 0;
+	for (i=0; i<64; i++) {
+		energy += MAX(clamp_soft(soft[i]), -clamp_soft(soft[i]));
+	}
+
+	return energy;
+}
+
+/* Map a dot product from [-energy, energy] to [0, 64]. If all the symbols have
+ * the same magnitude, this is the number of matching bits */
+static int
+soft_normalize(int dot, int energy)
+{
+	return energy ? 32 * (energy + dot) / energy : 0;
+}
+
+/* -128 is clamped to -127, so that the symbols can be negated without
+ * overflowing, same as in soft_derotate() */
+__attribute__((always_inline))
+static inline int8_t
+clamp_soft(int8_t x)
+{
+	return MAX(-127, x);
+}
+
+/* Highest correlation of a window to any rotation of the syncword. Rotating by
+ * 180 degrees flips all the bits, so the eight correlations can be computed
+ * with four popcounts */
+__attribute__((always_inline))
+static inline int
+correlate_rotations(uint64_t window)
+{
+	int i, corr, best;
 
-	for (corr = 0; v; corr++) {
-		v &= v-1;
+	best = 0;
+	for (i=0; i<CORR_BASE_ROTATIONS; i++) {
+		corr = correlate_u64(_syncwords[_base_rotations[i]], window);
+		best = MAX(best, MAX(corr, 64 - corr));
 	}
 
-	return 64 - corr;
+	return best;
 }
 /* }}} */
@@ -7,9 +7,14 @@
 #define CORR_THR 42     /* Empirical minimum correlation threshold for offset 0:
                          * if the correlation is > this value, we assume that
                          * the packet starts at offset 0 */
+#define CORR_BASE_ROTATIONS 4   /* Rotations of the syncword whose opposite is
+                                 * another rotation: 0, 90, INV_0 and INV_90
+                                 * degrees, in this order */
 
 /**
- * Initialize the correlator with a synchronization sequence
+ * Initialize the correlator with a synchronization sequence. The correlator
+ * looks for all the eight rotations of the syncword, with and without I and Q
+ * swapped
  *
  * @param syncword one of the four rotations representing the synchronization
  *        word
@@ -28,4 +33,81 @@ void correlator_init(uint64_t syncword);
  */
 int  correlate(enum phase *best_phase, uint8_t *hard_cadu, int len);
 
+/**
+ * Look for the synchronization word at the beginning of a buffer only, for
+ * when its position is already known (give or take a few bits)
+ *
+ * @param best_phase the rotation to which the synchronization word correlates
+ *        the best to. Will only be written to by the function
+ * @param best_corr pointer to where the correlation at the returned offset
+ *        should be written to (64 means that all the bits match)
+ * @param hard_cadu pointer to a byte buffer containing the data to correlate
+ *        the syncword to. Must be at least (span+64+7)/8 bytes long
+ * @param span number of offsets to check, starting from 0
+ * @return the offset with the highest correlation to the syncword
+ */
+int  correlate_near(enum phase *best_phase, int *best_corr, uint8_t *hard_cadu, int span);
+
+/**
+ * Soft-decision version of correlate(): look for the synchronization word
+ * inside a buffer of soft symbols, using the dot product between the symbols
+ * and each rotation of the syncword. Unlike the hard-decision correlator, this
+ * takes into account how reliable each symbol is
+ *
+ * @param best_phase the rotation to which the synchronization word correlates
+ *        the best to. Will only be written to by the function
+ * @param soft_cadu pointer to the soft symbols to correlate the syncword to
+ * @param len number of soft symbols in the buffer
+ * @return the offset with the highest correlation to the syncword
+ */
+int  correlate_soft(enum phase *best_phase, int8_t *soft_cadu, int len);
+
+/**
+ * Soft-decision version of correlate_near()
+ *
+ * @param best_phase the rotation to which the synchronization word correlates
+ *        the best to. Will only be written to by the function
+ * @param best_corr pointer to where the correlation at the returned offset
+ *        should be written to. The dot product is normalized by the magnitude
+ *        of the symbols, so that it is on the same scale as the hard-decision
+ *        correlation (64 means that the signs of all the symbols match)
+ * @param soft_cadu pointer to the soft symbols to correlate the syncword to.
+ *        Must be at least span+64 symbols long
+ * @param span number of offsets to check, starting from 0
+ * @return the offset with the highest correlation to the syncword
+ */
+int  correlate_soft_near(enum phase *best_phase, int *best_corr, int8_t *soft_cadu, int span);
+
+/**
+ * Compute the dot product between the soft symbols at each offset and each of
+ * the CORR_BASE_ROTATIONS rotations of the syncword. The dot products with the
+ * other rotations are the opposite of these
+ *
+ * @param dots pointers to where the dot products with each rotation should be
+ *        written to
+ * @param soft_cadu pointer to the soft symbols. Must be at least count+64
+ *        symbols long
+ * @param count number of offsets to compute the dot products at
+ */
+void correlate_soft_dots(int16_t *const *dots, int8_t *soft_cadu, int count);
+
+/**
+ * Get the rotation of the syncword with the highest dot product, given the dot
+ * products with the CORR_BASE_ROTATIONS rotations. Ties are resolved in favor
+ * of the lowest rotation, same as in correlate_soft()
+ *
+ * @param dots dot products with each of the CORR_BASE_ROTATIONS rotations
+ * @return the rotation with the highest dot product
+ */
+enum phase correlate_soft_rotation(const int *dots);
+
+/**
+ * Get the name of the hard and soft-decision correlation kernels selected by
+ * correlator_init()
+ *
+ * @return a string describing the kernel
+ */
+const char *correlator_kernel_name();
+const char *correlator_soft_kernel_name();
+
 #endif /* correlator_h */
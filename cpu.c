@@ -0,0 +1,77 @@
+#include <stdint.h>
+#if defined(__linux__) && (defined(__arm__) || defined(__aarch64__))
+#include <sys/auxv.h>
+#endif
+#include "cpu.h"
+
+static uint32_t detect_features();
+
+static int _detected;
+static uint32_t _features;
+static uint32_t _disabled;
+
+uint32_t
+cpu_features()
+{
+	if (!_detected) {
+		_features = detect_features();
+		_detected = 1;
+	}
+
+	return _features & ~_disabled;
+}
+
+void
+cpu_disable_features(uint32_t mask)
+{
+	_disabled |= mask;
+}
+
+const char*
+cpu_feature_name(enum cpu_feature feature)
+{
+	switch (feature) {
+		case CPU_SSE2:   return "sse2";
+		case CPU_SSSE3:  return "ssse3";
+		case CPU_SSE41:  return "sse4.1";
+		case CPU_POPCNT: return "popcnt";
+		case CPU_AVX2:   return "avx2";
+		case CPU_SIMD32: return "simd32";
+		case CPU_NEON:   return "neon";
+		default:         return "unknown";
+	}
+}
+
+/* Static functions {{{ */
+static uint32_t
+detect_features()
+{
+	uint32_t features = 0;
+
+#ifdef ARCH_X86
+	/* The builtins also check whether the OS saves the AVX registers */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))   features |= CPU_SSE2;
+	if (__builtin_cpu_supports("ssse3"))  features |= CPU_SSSE3;
+	if (__builtin_cpu_supports("sse4.1")) features |= CPU_SSE41;
+	if (__builtin_cpu_supports("popcnt")) features |= CPU_POPCNT;
+	if (__builtin_cpu_supports("avx2"))   features |= CPU_AVX2;
+#endif
+
+	/* SIMD32 is part of the baseline instruction set when the compiler
+	 * defines it. NEON is mandatory on aarch64, and optional on 32-bit ARM,
+	 * where the kernel reports it through the hwcaps */
+#if defined(__ARM_FEATURE_SIMD32)
+	features |= CPU_SIMD32;
+#endif
+#if defined(__aarch64__)
+	features |= CPU_NEON;
+#elif defined(__linux__) && defined(__arm__) && defined(HWCAP_NEON)
+	if (getauxval(AT_HWCAP) & HWCAP_NEON) features |= CPU_NEON;
+#elif defined(__ARM_NEON)
+	features |= CPU_NEON;
+#endif
+
+	return features;
+}
+/* }}} */
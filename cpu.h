@@ -0,0 +1,63 @@
+#ifndef cpu_h
+#define cpu_h
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ARCH_X86
+#endif
+
+/* Target attributes for the x86 kernel variants, so that they can be compiled
+ * without enabling the instruction set for the rest of the binary */
+#ifdef ARCH_X86
+#define TARGET_POPCNT __attribute__((target("popcnt")))
+#define TARGET_SSSE3  __attribute__((target("ssse3")))
+#define TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+
+/* NEON is mandatory on aarch64. On 32-bit ARM with a hardware FPU, gcc's
+ * arm_neon.h can be used from functions compiled with fpu=neon, so the NEON
+ * kernels are built that way and only selected when the CPU reports NEON */
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define ARCH_NEON
+#define TARGET_NEON
+#elif defined(__arm__) && defined(__ARM_FP) && !defined(__clang__) && __GNUC__ >= 7
+#define ARCH_NEON
+#define TARGET_NEON __attribute__((target("fpu=neon")))
+#endif
+
+enum cpu_feature {
+	CPU_SSE2   = 1 << 0,
+	CPU_SSSE3  = 1 << 1,
+	CPU_SSE41  = 1 << 2,
+	CPU_POPCNT = 1 << 3,
+	CPU_AVX2   = 1 << 4,
+	CPU_SIMD32 = 1 << 5,
+	CPU_NEON   = 1 << 6,
+};
+
+/**
+ * Detect the features supported by the CPU the decoder is running on. The
+ * result is cached after the first call.
+ *
+ * @return bitmask of cpu_feature values
+ */
+uint32_t cpu_features();
+
+/**
+ * Mask out a set of features, so that the kernels that depend on them will not
+ * be selected. Must be called before the decoder is initialized.
+ *
+ * @param mask bitmask of cpu_feature values to disable
+ */
+void     cpu_disable_features(uint32_t mask);
+
+/**
+ * Get the name of a feature
+ *
+ * @param feature one of the cpu_feature values
+ * @return a string describing the feature
+ */
+const char *cpu_feature_name(enum cpu_feature feature);
+
+#endif /* cpu_h */
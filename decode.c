@@ -1,26 +1,53 @@
 #include <stdint.h>
 #include <string.h>
 #include "channel.h"
+#include "correlator/accumulator.h"
 #include "correlator/autocorrelator.h"
 #include "correlator/correlator.h"
 #include "decode.h"
-#include "diffcode/diffcode.h"
 #include "deinterleave/deinterleave.h"
 #include "ecc/descramble.h"
 #include "ecc/rs.h"
 #include "ecc/viterbi.h"
+#include "frontend/frontend.h"
 #include "protocol/cadu.h"
 #include "parser/mpdu_parser.h"
 #include "parser/mcu_parser.h"
 #include "utils.h"
 
+/* Size of the ring holding the interleaved samples. The larger it is, the less
+ * often leftover samples have to be moved back to its start */
+#define RING_SIZE (8*INTER_SIZE(CADU_SOFT_LEN))
+
 static int read_samples(int (*read)(int8_t *dst, size_t len), int8_t *dst, size_t len);
+static int synchronize(enum phase *rotation, int8_t *soft_cadu, uint8_t *hard_cadu, enum phase derotated);
+static int inter_markers_match(const int8_t *soft, int len);
+static void ring_reserve(size_t len);
+static int ring_fill(int (*read)(int8_t *dst, size_t len), int len);
 
 static int _rs, _vit;
 static uint32_t _vcdu_seq;
 static int _diffcoded;
 static int _interleaved;
 static enum { READ, PARSE_MPDU, VIT_SECOND } _state;
+static enum { SYNC_SEARCH, SYNC_VERIFY, SYNC_LOCKED } _sync;
+static int _sync_hits, _sync_misses;
+static int _lock_hits, _unlock_misses;
+static int _lock_count, _unlock_count;
+static int _soft_sync;
+static SyncAccumulator *_accumulator;
+static int _acquire_cadus;
+static int _search_time, _lock_time;
+static enum phase _sync_rotation;
+static Autocorrelator _autocorrelator;
+static int _inter_locked, _inter_hits, _inter_misses;
+
+/* Interleaved samples read from the input. The samples before _ring_read were
+ * consumed by the deinterleaver, the ones up to _ring_commit were read but
+ * not consumed yet */
+static int8_t _ring[RING_SIZE];
+static uint8_t _ring_hard[INTER_SIZE(CADU_SOFT_LEN)/8 + 1];
+static int _ring_read, _ring_commit;
 
 #ifndef NDEBUG
 FILE *_vcdu;
@@ -39,6 +66,9 @@ decode_init(int diffcoded, int interleaved)
 	descramble_init();
 	rs_init();
 	mpdu_parser_init();
+	frontend_init();
+	deinterleave_init();
+	autocorrelator_init(&_autocorrelator, INTER_MARKER_STRIDE/8);
 
 #ifndef NDEBUG
 	_vcdu = fopen("/tmp/vcdu.data", "wb");
@@ -50,6 +80,49 @@ decode_init(int diffcoded, int interleaved)
 	_diffcoded = diffcoded;
 	_interleaved = interleaved;
 	_state = READ;
+
+	_sync = SYNC_SEARCH;
+	_sync_hits = 0;
+	_sync_misses = 0;
+	_lock_hits = SYNC_LOCK_HITS;
+	_unlock_misses = SYNC_UNLOCK_MISSES;
+	_lock_count = 0;
+	_unlock_count = 0;
+	_soft_sync = 0;
+	_acquire_cadus = 1;
+	_search_time = 0;
+	_lock_time = 0;
+	_sync_rotation = PHASE_0;
+	_inter_locked = 0;
+	_inter_hits = 0;
+	_inter_misses = 0;
+	memset(_ring, 0, INTER_MARKER_STRIDE);
+	_ring_read = _ring_commit = INTER_MARKER_STRIDE;
+}
+
+void
+decode_set_sync_hysteresis(int lock_hits, int unlock_misses)
+{
+	_lock_hits = MAX(1, lock_hits);
+	_unlock_misses = MAX(1, unlock_misses);
+}
+
+void
+decode_set_soft_sync(int soft)
+{
+	_soft_sync = soft;
+}
+
+int
+decode_set_sync_acquisition(int cadus)
+{
+	if (cadus > 1 && !_accumulator) {
+		if (!(_accumulator = accumulator_init(CADU_SOFT_LEN))) return 1;
+	}
+	if (_accumulator) accumulator_reset(_accumulator);
+
+	_acquire_cadus = MAX(1, cadus);
+	return 0;
 }
 
 DecoderState
@@ -63,33 +136,43 @@ decode_soft_cadu(Mpdu *dst, int (*read)(int8_t *dst, size_t len))
 	uint8_t hard_cadu[CONV_CADU_LEN];
 	int errors;
 	unsigned int i;
-	enum phase rotation;
+	enum phase rotation, derotated;
+	int warmup;
 
 	switch (_state) {
 		case READ:
+			/* Until every deinterleaver branch outputs actual data, only keep
+			 * it and the interleaving marker tracking going */
+			warmup = _interleaved && deinterleave_warmup() > 0;
+
 			/* Read a CADU worth of samples */
 			for (i=0; i<CADU_SOFT_LEN; i+=CADU_SOFT_CHUNK) {
 				if (read_samples(read, soft_cadu+i, CADU_SOFT_CHUNK)) return EOF_REACHED;
 			}
+			if (warmup) return NOT_READY;
 
-			/* Differentially decode if necessary */
-			if (_diffcoded) diff_decode(soft_cadu, CADU_SOFT_LEN);
+			/* Differentially decode if necessary, derotate and slice in a
+			 * single pass, assuming that the rotation has not changed since
+			 * the last syncword */
+			derotated = _sync_rotation;
+			frontend_process(hard_cadu, soft_cadu, CADU_SOFT_LEN, derotated, _diffcoded);
 
-			/* Perform correlation and advance to the next state */
-			soft_to_hard(hard_cadu, soft_cadu, CADU_SOFT_LEN);
-			offset = correlate(&rotation, hard_cadu, CONV_CADU_LEN);
+			/* Find the syncword and advance to the next state */
+			offset = synchronize(&rotation, soft_cadu, hard_cadu, derotated);
 
 			/* Read more samples to get a full CADU */
 			if (offset > 0) {
 				if (read_samples(read, soft_cadu+CADU_SOFT_LEN, offset)) return EOF_REACHED;
-				if (_diffcoded) diff_decode(soft_cadu+CADU_SOFT_LEN, offset);
+				frontend_process(NULL, soft_cadu+CADU_SOFT_LEN, offset, derotated, _diffcoded);
 			}
 
-			/* Derotate */
-			soft_derotate(soft_cadu+offset, CADU_SOFT_LEN, rotation);
+			/* Undo the rest of the rotation, if it did change */
+			rotation = phase_residual(derotated, rotation);
+			if (rotation != PHASE_0) soft_derotate(soft_cadu+offset, CADU_SOFT_LEN, rotation);
 
-			/* Finish decoding the past frame (output is VITERBI_DELAY bits late) */
-			vit = viterbi_decode(((uint8_t*)&cadu) + sizeof(Cadu)-VITERBI_DELAY,
+			/* Finish decoding the past frame (output is VITERBI_DELAY bytes
+			 * late), tracing back the whole CADU at once */
+			vit = viterbi_decode_block((uint8_t*)&cadu,
 					soft_cadu+offset,
 					VITERBI_DELAY);
 
@@ -127,9 +210,9 @@ decode_soft_cadu(Mpdu *dst, int (*read)(int8_t *dst, size_t len))
 			break;
 
 		case VIT_SECOND:
-			/* Viterbi decode (2/2) */
-			vit += viterbi_decode((uint8_t*)&cadu,
-					soft_cadu+offset+2*8*VITERBI_DELAY,
+			/* Viterbi forward pass over the rest of the CADU. Bits will be
+			 * written out by the traceback at the beginning of the next one */
+			vit += viterbi_advance(soft_cadu+offset+2*8*VITERBI_DELAY,
 					sizeof(Cadu)-VITERBI_DELAY);
 			_vit = vit / sizeof(Cadu);
 			_state = READ;
@@ -162,63 +245,253 @@ decode_get_vcdu_seq()
 	return _vcdu_seq;
 }
 
+int
+decode_get_locked()
+{
+	return _sync == SYNC_LOCKED;
+}
+
+int
+decode_get_lock_count()
+{
+	return _lock_count;
+}
+
+int
+decode_get_unlock_count()
+{
+	return _unlock_count;
+}
+
+int
+decode_get_lock_time()
+{
+	return _lock_time;
+}
+
+/* Find the syncword in a CADU whose samples were already derotated by
+ * derotated. The rotation found is relative to the original samples */
+static int
+synchronize(enum phase *rotation, int8_t *soft_cadu, uint8_t *hard_cadu, enum phase derotated)
+{
+	int offset, corr, runner_up;
+
+	if (_sync != SYNC_LOCKED) _search_time++;
+
+	if (_sync != SYNC_SEARCH) {
+		/* The syncword is expected at the beginning of the buffer: only check
+		 * the first few offsets */
+		if (_soft_sync) {
+			offset = correlate_soft_near(rotation, &corr, soft_cadu, SYNC_TRACK_SPAN);
+		} else {
+			offset = correlate_near(rotation, &corr, hard_cadu, SYNC_TRACK_SPAN);
+		}
+		*rotation = phase_combine(derotated, *rotation);
+
+		/* Anything other than the expected position and rotation must
+		 * correlate better, since checking multiple offsets makes it more
+		 * likely for random data to go over the threshold */
+		if ((!offset && *rotation == _sync_rotation && corr > CORR_THR) || corr > SYNC_SLIP_THR) {
+			_sync_misses = 0;
+			_sync_rotation = *rotation;
+			if (_sync == SYNC_VERIFY && ++_sync_hits >= _lock_hits) {
+				_sync = SYNC_LOCKED;
+				_lock_count++;
+				_lock_time = _search_time;
+				_search_time = 0;
+			}
+			return offset;
+		}
+
+		/* While locked, a missing syncword is most likely just corrupted by
+		 * noise: coast along at the expected position and rotation */
+		if (_sync == SYNC_LOCKED && ++_sync_misses < _unlock_misses) {
+			*rotation = _sync_rotation;
+			return 0;
+		}
+
+		if (_sync == SYNC_LOCKED) {
+			_unlock_count++;
+			_search_time = 1;
+		}
+		_sync = SYNC_SEARCH;
+	}
+
+	/* Look for the syncword over the whole CADU */
+	if (_acquire_cadus > 1) {
+		/* Add up the correlations of consecutive CADUs, using the best
+		 * position so far in the meantime */
+		accumulator_feed(_accumulator, soft_cadu, CADU_SOFT_LEN);
+		offset = accumulator_best(_accumulator, rotation, &corr, &runner_up);
+		*rotation = phase_combine(derotated, *rotation);
+
+		/* If the syncword clearly stands out, its position has already been
+		 * confirmed over several CADUs: lock right away */
+		if (corr - runner_up >= SYNC_ACQUIRE_MARGIN) {
+			accumulator_reset(_accumulator);
+			_sync = SYNC_LOCKED;
+			_sync_misses = 0;
+			_sync_rotation = *rotation;
+			_lock_count++;
+			_lock_time = _search_time;
+			_search_time = 0;
+			return offset;
+		}
+
+		/* Otherwise, keep accumulating until enough CADUs are in, then go
+		 * through the usual verification */
+		if (accumulator_frames(_accumulator) < _acquire_cadus) {
+			accumulator_advance(_accumulator, CADU_SOFT_LEN + offset);
+			return offset;
+		}
+		accumulator_reset(_accumulator);
+	} else if (_soft_sync) {
+		offset = correlate_soft(rotation, soft_cadu, CADU_SOFT_LEN);
+		*rotation = phase_combine(derotated, *rotation);
+	} else {
+		offset = correlate(rotation, hard_cadu, CONV_CADU_LEN);
+		*rotation = phase_combine(derotated, *rotation);
+	}
+
+	/* The next syncword is now expected right after this CADU. Wait for it
+	 * to be found there before trusting the position */
+	_sync = SYNC_VERIFY;
+	_sync_hits = 0;
+	_sync_misses = 0;
+	_sync_rotation = *rotation;
+
+	return offset;
+}
+
 static int
 read_samples(int (*read)(int8_t *dst, size_t len), int8_t *dst, size_t len)
 {
-	static int offset;
-	static int8_t from_prev[INTER_MARKER_STRIDE];
+	static enum phase rotation;
+	int8_t *src;
 	int deint_offset;
 	int num_samples;
-	uint8_t hard[INTER_SIZE(len)];
-	static enum phase rotation;
+	int offset;
+	int hit;
 
 	/* If not interleaved, directly read and return */
 	if (!_interleaved) return !read(dst, len);
 
 	/* Retrieve enough samples so that the deinterleaver will output
-	 * $len samples. Use the internal cache first */
+	 * $len samples, on top of the ones left in the ring by the last call */
 	num_samples = deinterleave_num_samples(len);
-	if (offset) {
-		memcpy(dst, from_prev, MIN(offset, num_samples));
-		memcpy(from_prev, from_prev+offset, offset-MIN(offset, num_samples));
-	}
-	if (num_samples-offset > 0 && !read(dst+offset, num_samples-offset)) return 1;
-	offset -= MIN(offset, num_samples);
+	ring_reserve(num_samples + INTER_MARKER_STRIDE);
+	if (ring_fill(read, num_samples - (_ring_commit - _ring_read))) return 1;
+	src = _ring + _ring_read;
 
 	if (num_samples < INTER_MARKER_STRIDE*8) {
 		/* Not enough bytes to reliably find sync marker offset: assume the
 		 * offset is correct, and just derotate and deinterleave what we read */
-		soft_derotate(dst, num_samples, rotation);
-		deinterleave(dst, dst, len);
+		offset = 0;
+		soft_derotate(src, num_samples, rotation);
+		autocorrelator_advance(&_autocorrelator, num_samples);
 	} else {
-		/* Find synchronization marker (offset with the best autocorrelation) */
-		soft_to_hard(hard, dst, num_samples & ~0x7);
-		offset = autocorrelate(&rotation, INTER_MARKER_STRIDE/8, hard, num_samples/8);
-
 		/* Get where the deinterleaver expects the next marker to be */
 		deint_offset = deinterleave_expected_sync_offset();
 
-		/* Compute the delta between the expected marker position and the
-		 * one found by the correlator */
-		offset = (offset - deint_offset + INTER_MARKER_INTERSAMPS + 1) % INTER_MARKER_STRIDE;
-		offset = offset > INTER_MARKER_STRIDE/2 ? offset-INTER_MARKER_STRIDE : offset;
-
-		/* If the offset is positive, read more
-		 * bits to get $num_samples valid samples. If the offset is negative,
-		 * copy the last few bytes into the local cache */
-		if (offset > 0) {
-			if (!read(dst+num_samples, offset)) return 1;
+		if (_inter_locked) {
+			/* The markers were where expected in the last chunks: assume
+			 * they still are, and check them after derotating */
+			offset = 0;
 		} else {
-			memcpy(from_prev, dst+num_samples+offset, -offset);
+			/* Find synchronization marker (offset with the best autocorrelation) */
+			soft_to_hard(_ring_hard, src, num_samples & ~0x7);
+			offset = autocorrelate(&_autocorrelator, &rotation, _ring_hard, num_samples/8);
+
+			/* Compute the delta between the expected marker position and the
+			 * one found by the correlator */
+			offset = (offset - deint_offset + INTER_MARKER_INTERSAMPS + 1) % INTER_MARKER_STRIDE;
+			offset = offset > INTER_MARKER_STRIDE/2 ? offset-INTER_MARKER_STRIDE : offset;
 		}
 
-		/* Correct rotation for these samples */
-		soft_derotate(dst, num_samples+offset, rotation);
+		/* If the offset is positive, read more bits to get $num_samples
+		 * valid samples. If the offset is negative, the last few samples
+		 * stay in the ring for the next call */
+		if (offset > 0 && ring_fill(read, offset)) return 1;
+
+		/* The next samples start right after the ones that were just
+		 * consumed, including the ones skipped or left in the ring */
+		autocorrelator_advance(&_autocorrelator, num_samples + offset);
 
-		/* Deinterleave */
-		deinterleave(dst, dst+offset, len);
-		offset = offset < 0 ? -offset : 0;
+		/* Correct rotation for these samples */
+		soft_derotate(src, num_samples+offset, rotation);
+
+		/* Update the lock state. While locked, chunks with the markers
+		 * elsewhere are still deinterleaved as if they were where expected,
+		 * until too many of them are missed in a row */
+		hit = !offset && inter_markers_match(src + deint_offset, num_samples - deint_offset);
+		if (_inter_locked) {
+			_inter_misses = hit ? 0 : _inter_misses + 1;
+			if (_inter_misses >= INTER_UNLOCK_MISSES) {
+				_inter_locked = 0;
+				_inter_hits = 0;
+				autocorrelator_reset(&_autocorrelator);
+			}
+		} else {
+			_inter_hits = hit ? _inter_hits + 1 : 0;
+			if (_inter_hits >= INTER_LOCK_HITS) {
+				_inter_locked = 1;
+				_inter_misses = 0;
+			}
+		}
 	}
 
+	/* Deinterleave straight out of the ring. If the offset is negative,
+	 * this starts with a few samples that were already consumed, which
+	 * only pad the deinterleaver up to the marker */
+	deinterleave(dst, src + offset, len);
+	_ring_read += num_samples + offset;
+
+	return 0;
+}
+
+/* Make room for len more samples in the ring. The samples are kept contiguous
+ * so that they can be processed in place: once the end of the buffer is
+ * reached, the ones not consumed yet are moved back to its start, along with a
+ * marker period of consumed ones that read_samples() may go back to */
+static void
+ring_reserve(size_t len)
+{
+	int start;
+
+	if (_ring_commit + len <= RING_SIZE) return;
+
+	start = _ring_read - INTER_MARKER_STRIDE;
+	memmove(_ring, _ring + start, _ring_commit - start);
+	_ring_read -= start;
+	_ring_commit -= start;
+}
+
+/* Read len samples from the input at the commit cursor of the ring, if len is
+ * positive. Returns non-zero if the end of the input was reached */
+static int
+ring_fill(int (*read)(int8_t *dst, size_t len), int len)
+{
+	if (len <= 0) return 0;
+	if (!read(_ring + _ring_commit, len)) return 1;
+
+	_ring_commit += len;
 	return 0;
 }
+
+/* Check whether the interleaver markers in a buffer of derotated samples match
+ * INTER_MARKER, starting from the first sample of the buffer */
+static int
+inter_markers_match(const int8_t *soft, int len)
+{
+	int i, j, matches, total;
+
+	matches = total = 0;
+	for (i=0; i+8 <= len; i += INTER_MARKER_STRIDE) {
+		for (j=0; j<8; j++) {
+			matches += (soft[i+j] < 0) == ((INTER_MARKER >> (7-j)) & 0x1);
+		}
+		total += 8;
+	}
+
+	return total && 100*matches >= INTER_MARKER_THR*total;
+}
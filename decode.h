@@ -12,6 +12,28 @@
                                    phase inversions and such, but makes locking
                                    on to a weak signal harder */
 
+#define SYNC_TRACK_SPAN 16      /* Offsets checked for the syncword once locked,
+                                   starting from its expected position */
+#define SYNC_SLIP_THR 50        /* Minimum correlation for a syncword found
+                                   anywhere else than its expected position and
+                                   rotation to be considered valid */
+#define SYNC_LOCK_HITS 2        /* Default number of consecutive syncwords
+                                   found at the expected position to lock */
+#define SYNC_UNLOCK_MISSES 3    /* Default number of consecutive syncwords
+                                   missed before going back to a full search */
+#define SYNC_ACQUIRE_MARGIN 14  /* Minimum difference between the best and the
+                                   second best accumulated correlations to stop
+                                   accumulating early */
+
+#define INTER_LOCK_HITS 2       /* Consecutive chunks with the interleaver
+                                   markers at their expected position before
+                                   the autocorrelation is skipped */
+#define INTER_UNLOCK_MISSES 2   /* Consecutive chunks without the interleaver
+                                   markers at their expected position before
+                                   going back to autocorrelating */
+#define INTER_MARKER_THR 75     /* Minimum percentage of marker bits matching
+                                   for a chunk to count as a hit */
+
 typedef enum {
 	EOF_REACHED=0, NOT_READY, MPDU_READY, STATS_ONLY
 } DecoderState;
@@ -24,6 +46,44 @@ typedef enum {
  */
 void decode_init(int diffcoded, int interleaved);
 
+/**
+ * Configure the hysteresis of the synchronization flywheel. Once the syncword
+ * has been found at its expected position lock_hits times in a row, only the
+ * first SYNC_TRACK_SPAN offsets of each CADU are checked, and if the syncword
+ * is not found there, it is assumed to be at its expected position anyway.
+ * After unlock_misses consecutive misses, the decoder goes back to searching
+ * the syncword over the whole CADU. Must be called after decode_init().
+ *
+ * @param lock_hits number of consecutive hits required to lock
+ * @param unlock_misses number of consecutive misses required to unlock
+ */
+void decode_set_sync_hysteresis(int lock_hits, int unlock_misses);
+
+/**
+ * Select the correlator used to find the syncword. The soft-decision
+ * correlator is slower, but takes into account the magnitude of the soft
+ * symbols, which makes it less likely to lock on to random data when the
+ * signal is weak. Must be called after decode_init().
+ *
+ * @param soft 1 to use the soft-decision correlator, 0 to use the
+ *        hard-decision one (default)
+ */
+void decode_set_soft_sync(int soft);
+
+/**
+ * Accumulate the soft-decision correlations of several consecutive CADUs when
+ * looking for the syncword over the whole CADU, instead of relying on a single
+ * CADU. Accumulation stops early once the syncword stands out by at least
+ * SYNC_ACQUIRE_MARGIN, so this only slows down acquisition when the signal is
+ * weak. In the meantime, CADUs are decoded using the best position found so
+ * far. Must be called after decode_init().
+ *
+ * @param cadus number of CADUs to accumulate. 1 disables accumulation
+ *        (default)
+ * @return 0 on success, non-zero on failure
+ */
+int  decode_set_sync_acquisition(int cadus);
+
 /**
  * Fetch a CADU usinge the given function pointer, and decode all the valid
  * MPDUs in it.
@@ -43,10 +103,16 @@ DecoderState decode_soft_cadu(Mpdu *dst, int(*read_samples)(int8_t *dst, size_t
 
 /**
  * Various accessors to private decoder data: Reed-solomon errors, average
- * Viterbi cost, VCDU sequence number
+ * Viterbi cost, VCDU sequence number, whether the synchronization flywheel is
+ * locked, how many times it locked and lost lock so far, and how many CADUs
+ * it took to lock the last time
  */
 int decode_get_rs();
 int decode_get_vit();
 uint32_t decode_get_vcdu_seq();
+int decode_get_locked();
+int decode_get_lock_count();
+int decode_get_unlock_count();
+int decode_get_lock_time();
 
 #endif /* decode_h */
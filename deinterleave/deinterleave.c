@@ -1,42 +1,99 @@
-#include <assert.h>
 #include <stdint.h>
+#include <string.h>
+#ifdef USE_HUGEPAGES
+#include <sys/mman.h>
+#endif
 #include "deinterleave.h"
+#include "utils.h"
 
-static int8_t _deint[INTER_BRANCH_COUNT * INTER_BRANCH_COUNT * INTER_BRANCH_DELAY];
+/* Each branch is a FIFO, delaying its samples by INTER_BRANCH_DELAY samples of
+ * the same branch more than the next branch. The last branch is not delayed */
+#define FIFO_LEN(branch) ((INTER_BRANCH_COUNT - 1 - (branch)) * INTER_BRANCH_DELAY)
+
+/* Space left after each FIFO. Without it, the FIFO lengths being multiples of
+ * INTER_BRANCH_DELAY, all the branches would be accessed at addresses that map
+ * to the same cache sets */
+#define FIFO_PAD 64
+
+#define DEINT_SIZE (INTER_BRANCH_COUNT * (INTER_BRANCH_COUNT - 1) / 2 * INTER_BRANCH_DELAY \
+                    + INTER_BRANCH_COUNT * FIFO_PAD)
+
+#ifdef USE_HUGEPAGES
+#define HUGE_PAGE_SIZE (2 << 20)
+static int8_t _deint[(DEINT_SIZE + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE]
+	__attribute__((aligned(HUGE_PAGE_SIZE)));
+#else
+static int8_t _deint[DEINT_SIZE];
+#endif
+static int8_t *_fifo[INTER_BRANCH_COUNT];
+static int _pos[INTER_BRANCH_COUNT];
 static int _cur_branch = 0;
-static int _offset = 0;
+static size_t _warmup = 0;
+
+void
+deinterleave_init()
+{
+	int i;
+
+#if defined(USE_HUGEPAGES) && defined(MADV_HUGEPAGE)
+	/* Only a hint: if transparent huge pages are not available, the buffer
+	 * is simply backed by regular pages */
+	madvise(_deint, sizeof(_deint), MADV_HUGEPAGE);
+#endif
+
+	memset(_deint, 0, sizeof(_deint));
+
+	_fifo[0] = _deint;
+	for (i=1; i<INTER_BRANCH_COUNT; i++) {
+		_fifo[i] = _fifo[i-1] + FIFO_LEN(i-1) + FIFO_PAD;
+	}
+	memset(_pos, 0, sizeof(_pos));
+	_cur_branch = 0;
+
+	/* Branch 0 is the first to output actual data, after going through its
+	 * whole FIFO once */
+	_warmup = (size_t)INTER_BRANCH_COUNT * FIFO_LEN(0);
+}
 
 void
 deinterleave(int8_t *dst, const int8_t *src, size_t len)
 {
-	int delay, write_idx, read_idx;
-	size_t i;
+	int8_t *fifo, sample;
+	int branch, end, run;
 
-	read_idx = (_offset + INTER_BRANCH_COUNT*INTER_BRANCH_DELAY) % sizeof(_deint);
-	assert(len < sizeof(_deint));
+	_warmup -= MIN(_warmup, len);
 
-	/* Write bits to the deinterleaver */
-	for (i=0; i<len; i++) {
+	while (len > 0) {
 
 		/* Skip sync marker */
 		if (!_cur_branch) {
 			src += 8;
 		}
 
-		/* Compute the delay of the current symbol based on the branch we're on */
-		delay = (_cur_branch % INTER_BRANCH_COUNT) * INTER_BRANCH_DELAY * INTER_BRANCH_COUNT;
-		write_idx = (_offset - delay + sizeof(_deint)) % sizeof(_deint);
+		/* Go through the branches up to the last one, or until the
+		 * requested number of samples */
+		branch = _cur_branch < INTER_BRANCH_COUNT ? _cur_branch : _cur_branch - INTER_BRANCH_COUNT;
+		run = MIN(len, (size_t)(INTER_BRANCH_COUNT - branch));
+		end = branch + run;
 
-		_deint[write_idx] = *src++;
+		/* Swap each sample with the oldest one in its branch */
+		for (; branch < MIN(end, INTER_BRANCH_COUNT - 1); branch++) {
+			fifo = _fifo[branch] + _pos[branch];
+			sample = *src++;
+			*dst++ = *fifo;
+			*fifo = sample;
 
-		_offset = (_offset + 1) % sizeof(_deint);
-		_cur_branch = (_cur_branch + 1) % INTER_MARKER_INTERSAMPS;
-	}
+			if (++_pos[branch] == FIFO_LEN(branch)) _pos[branch] = 0;
+		}
+
+		/* The last branch goes straight through */
+		if (end == INTER_BRANCH_COUNT) {
+			*dst++ = *src++;
+		}
 
-	/* Read bits from the deinterleaver */
-	for (; len>0; len--) {
-		*dst++ = _deint[read_idx];
-		read_idx = (read_idx + 1) % sizeof(_deint);
+		len -= run;
+		_cur_branch += run;
+		if (_cur_branch == INTER_MARKER_INTERSAMPS) _cur_branch = 0;
 	}
 }
 
@@ -59,3 +116,9 @@ deinterleave_expected_sync_offset()
 {
 	return _cur_branch ? INTER_MARKER_INTERSAMPS - _cur_branch : 0;
 }
+
+size_t
+deinterleave_warmup()
+{
+	return _warmup;
+}
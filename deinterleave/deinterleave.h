@@ -13,11 +13,17 @@
 
 #define INTER_SIZE(x) (x*10/9+8)
 
+/**
+ * Initialize the deinterleaver, emptying its branches
+ */
+void   deinterleave_init();
+
 /**
  * Deinterleave a set of soft samples, and extract a corresponding number of
  * bits from the deinterleaver
  *
- * @param dst pointer to a buffer where the deinterleaved samples should be written
+ * @param dst pointer to a buffer where the deinterleaved samples should be
+ *        written. Can be the same as src, or before it, but not after it
  * @param src pointer to the raw interleaved samples
  * @param len number of samples to read. len*72/80 bits will be written
  */
@@ -39,4 +45,13 @@ size_t deinterleave_num_samples(size_t output_count);
  */
 int    deinterleave_expected_sync_offset();
 
+/**
+ * Get how many samples have yet to be output before the delay lines are full.
+ * Until then, some of the output samples are the zeroes the deinterleaver was
+ * initialized with rather than actual data
+ *
+ * @return number of deinterleaved samples left until all of them are valid
+ */
+size_t deinterleave_warmup();
+
 #endif /* deinterleave_h */
@@ -1,9 +0,0 @@
-#ifndef diffcode_h
-#define diffcode_h
-
-#include <stdint.h>
-#include <stdlib.h>
-
-void diff_decode(int8_t *soft_cadu, size_t len);
-
-#endif /* diffcode_h */
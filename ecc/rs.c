@@ -1,35 +1,67 @@
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include "cpu.h"
 #include "protocol/vcdu.h"
 #include "rs.h"
 #include "utils.h"
-
-static int fix_block(uint8_t *data);
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
+
+/* The SIMD syndrome kernels read the VCDU 16 bytes at a time, that is 4
+ * consecutive positions of each of the interleaved blocks */
+#define SYNDROME_GROUPS ((RS_N * INTERLEAVING + 15) / 16)
+
+static void select_kernel();
+static int fix_block(uint8_t *data, const uint8_t *syndrome);
+
+static void syndromes_generic(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data);
+#ifdef ARCH_X86
+TARGET_SSSE3 static void syndromes_ssse3(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data);
+TARGET_AVX2 static void syndromes_avx2(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data);
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static void syndromes_neon(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data);
+#endif
 
 static uint8_t gfmul(uint8_t x, uint8_t y);
 static uint8_t gfdiv(uint8_t x, uint8_t y);
-static uint8_t gfpow(uint8_t x, int exp);
-static void poly_deriv(uint8_t *dst, const uint8_t *poly, int len);
-static uint8_t poly_eval(const uint8_t *poly, uint8_t x, int len);
 static void poly_mul(uint8_t *dst, const uint8_t *poly1, const uint8_t *poly2, int len_1, int len_2);
 
-static uint8_t _alpha[RS_N+1];
+/* Exponents are looked up without reducing them modulo RS_N, so the table
+ * repeats itself to cover the sum of two logs */
+static uint8_t _alpha[2*RS_N];
 static uint8_t _logtable[RS_N+1];
-static uint8_t _gaproot[RS_N];
 static uint8_t _zeroes[RS_T];
 
+/* For each position in the block, the log of the root of the error locator
+ * polynomial that corresponds to an error there, and the log of that root
+ * raised to FIRST_ROOT, used to compute the error value */
+static uint8_t _root_log[RS_N];
+static uint8_t _forney_log[RS_N];
+
+/* Split-nibble multiplication tables for the SIMD syndrome kernels: x times the
+ * k-th power of the i-th root of the generator polynomial is
+ * _syndrome_mul[i][k-1][0][x & 0xF] ^ _syndrome_mul[i][k-1][1][x >> 4] */
+static uint8_t _syndrome_mul[RS_T][4][2][16];
+
+/* Kernel, selected by rs_init() based on the CPU features */
+static void (*_syndromes)(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data);
+static const char *_kernel_name;
+
 void
 rs_init()
 {
-	int i, tmp;
+	int i, j, k, tmp;
 	int exp;
+	uint8_t factor;
 
 	_alpha[0] = 1;
 	_logtable[1] = 0;
-     /* Not entirely sure what's going on here, but the logtable doesn't have
-      * this number anywhere, and setting log[0] = 183 fixes the _gaproot error */
-	_logtable[0] = 183;
 
 	/* Initialize the exponent and logarithm tables */
 	for (i=1; i<RS_N; i++) {
@@ -38,13 +70,8 @@ rs_init()
 		_alpha[i] = tmp;
 		_logtable[tmp] = i;
 	}
-
-	_logtable[255] = 183;
-	_alpha[255] = 0;
-
-	/* Compute the gap'th log */
-	for (i=0; i<RS_N; i++) {
-		_gaproot[gfpow(i, ROOT_SKIP)] = i;
+	for (i=RS_N; i<2*RS_N; i++) {
+		_alpha[i] = _alpha[i - RS_N];
 	}
 
 	/* Compute the roots of the generator polynomial */
@@ -52,6 +79,25 @@ rs_init()
 		exp = ((i + FIRST_ROOT) * ROOT_SKIP) % RS_N;
 		_zeroes[i] = _alpha[exp];
 	}
+
+	/* An error at position i has locator alpha^(i*ROOT_SKIP), and the root of
+	 * the error locator polynomial is its inverse */
+	for (i=0; i<RS_N; i++) {
+		_root_log[i] = (RS_N - (i * ROOT_SKIP) % RS_N) % RS_N;
+		_forney_log[i] = (_root_log[i] * FIRST_ROOT) % RS_N;
+	}
+
+	for (i=0; i<RS_T; i++) {
+		for (k=1; k<=4; k++) {
+			factor = _alpha[(_logtable[_zeroes[i]] * k) % RS_N];
+			for (j=0; j<16; j++) {
+				_syndrome_mul[i][k-1][0][j] = gfmul(j, factor);
+				_syndrome_mul[i][k-1][1][j] = gfmul(j << 4, factor);
+			}
+		}
+	}
+
+	select_kernel();
 }
 
 int
@@ -59,18 +105,35 @@ rs_fix(Vcdu *c)
 {
 	int i, j;
 	int errors, errdelta;
+	int has_errors;
+	uint8_t syndromes[RS_T][INTERLEAVING];
+	uint8_t syndrome[RS_T];
 	uint8_t block[RS_N];
 	uint8_t *const data_start = (uint8_t*)c;
 
+	/* Compute the syndromes of all the blocks at once, straight from the
+	 * interleaved data */
+	if (!_syndromes) select_kernel();
+	_syndromes(syndromes, data_start);
+
 	errors = 0;
 	for (i=0; i<INTERLEAVING; i++) {
+		has_errors = 0;
+		for (j=0; j<RS_T; j++) {
+			syndrome[j] = syndromes[j][i];
+			has_errors |= syndrome[j];
+		}
+
+		/* Blocks without errors are left alone */
+		if (!has_errors) continue;
+
 		/* Deinterleave */
 		for (j=0; j<RS_N; j++) {
 			block[j] = data_start[j*INTERLEAVING + i];
 		}
 
 		/* Fix errors */
-		errdelta = fix_block(block);
+		errdelta = fix_block(block, syndrome);
 		if (errdelta < 0 || errors < 0) {
 			errors = -1;
 		} else {
@@ -86,30 +149,51 @@ rs_fix(Vcdu *c)
 	return errors;
 }
 
+const char*
+rs_kernel_name()
+{
+	if (!_syndromes) select_kernel();
+	return _kernel_name;
+}
+
 /* Static functions {{{ */
+static void
+select_kernel()
+{
+	_syndromes = syndromes_generic;
+	_kernel_name = "generic";
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	_syndromes = syndromes_neon;
+	_kernel_name = "neon";
+#endif
+#ifdef ARCH_X86
+	if (cpu_features() & CPU_SSSE3) {
+		_syndromes = syndromes_ssse3;
+		_kernel_name = "ssse3";
+	}
+	if (cpu_features() & CPU_AVX2) {
+		_syndromes = syndromes_avx2;
+		_kernel_name = "avx2";
+	}
+#endif
+}
+
+/* Fix the errors in a block, given its syndromes, at least one of which must be
+ * non-zero */
 static int
-fix_block(uint8_t *data)
+fix_block(uint8_t *data, const uint8_t *syndrome)
 {
-	int i, m, n, delta, prev_delta;
+	int i, j, m, n, delta, prev_delta;
 	int lambda_deg;
-	int has_errors;
 	int error_count;
-	uint8_t syndrome[RS_T];
+	int terms, pos, exp;
+	int term_log[RS_T2+1], term_step[RS_T2+1];
 	uint8_t lambda[RS_T2+1], prev_lambda[RS_T2+1], tmp[RS_T2+1];
-	uint8_t lambda_root[RS_T2], error_pos[RS_T2];
-	uint8_t omega[RS_T], lambda_prime[RS_T2];
-	uint8_t num, den, fcr;
-
-	/* Compute syndromes */
-	has_errors = 0;
-	for (i=0; i<RS_T; i++) {
-		syndrome[i] = poly_eval(data, _zeroes[i], RS_N);
-		has_errors |= syndrome[i];
-	}
-	if (!has_errors) {
-		return 0;
-	}
-
+	uint8_t term_odd[RS_T2+1];
+	uint8_t error_pos[RS_T2], lambda_odd[RS_T2];
+	uint8_t omega[RS_T], omega_log[RS_T];
+	uint8_t sum[2], num;
 
 	/* Berlekamp-Massey algorithm */
 	memset(lambda, 0, sizeof(lambda));
@@ -149,12 +233,31 @@ fix_block(uint8_t *data)
 		}
 	}
 
-	/* Roots bruteforcing */
+	/* Chien search: evaluate the error locator polynomial at the root
+	 * corresponding to each position in the block, updating each of its terms
+	 * in the log domain from one position to the next */
+	terms = 0;
+	for (i=0; i<=MIN(lambda_deg, RS_T2); i++) {
+		if (lambda[i]) {
+			term_log[terms] = _logtable[lambda[i]];
+			term_step[terms] = (RS_N - (i * ROOT_SKIP) % RS_N) % RS_N;
+			term_odd[terms] = i & 1;
+			terms++;
+		}
+	}
+
 	error_count = 0;
-	for (i=1; i<=RS_N && error_count < lambda_deg; i++) {
-		if (poly_eval(lambda, i, RS_T2+1) == 0) {
-			lambda_root[error_count] = i;
-			error_pos[error_count] = _logtable[_gaproot[gfdiv(1, i)]];
+	for (pos=0; pos<RS_N && error_count < lambda_deg; pos++) {
+		sum[0] = sum[1] = 0;
+		for (i=0; i<terms; i++) {
+			sum[term_odd[i]] ^= _alpha[term_log[i]];
+			term_log[i] += term_step[i];
+			if (term_log[i] >= RS_N) term_log[i] -= RS_N;
+		}
+
+		if (sum[0] == sum[1]) {
+			error_pos[error_count] = pos;
+			lambda_odd[error_count] = sum[1];
 			error_count++;
 		}
 	}
@@ -164,46 +267,229 @@ fix_block(uint8_t *data)
 	}
 
 	poly_mul(omega, syndrome, lambda, RS_T, RS_T2+1);
-	poly_deriv(lambda_prime, lambda, RS_T2+1);
+	for (i=0; i<RS_T; i++) {
+		omega_log[i] = _logtable[omega[i]];
+	}
 
-	/* Fix errors in the block */
+	/* Fix errors in the block using Forney's algorithm. The odd terms of the
+	 * error locator polynomial evaluated at a root X^-1 sum up to
+	 * X^-1 * lambda'(X^-1), so the error value is
+	 * omega(X^-1) * X^-FIRST_ROOT / odd(X^-1) */
 	for (i=0; i<error_count; i++) {
-		/* lambda_root[i] = 1/Xi, Xi being the i-th error locator */
-		fcr = gfpow(lambda_root[i], FIRST_ROOT-1);
-		num = poly_eval(omega, lambda_root[i], RS_T);
-		den = poly_eval(lambda_prime, lambda_root[i], RS_T2);
+		pos = error_pos[i];
+
+		num = 0;
+		exp = 0;
+		for (j=0; j<RS_T; j++) {
+			if (omega[j]) num ^= _alpha[omega_log[j] + exp];
+			exp += _root_log[pos];
+			if (exp >= RS_N) exp -= RS_N;
+		}
 
-		data[error_pos[i]] ^= gfdiv(gfmul(num, fcr), den);
+		if (num && lambda_odd[i]) {
+			exp = _logtable[num] + _forney_log[pos] + RS_N - _logtable[lambda_odd[i]];
+			data[pos] ^= _alpha[exp % RS_N];
+		}
 	}
 
 	return error_count;
 }
 
-static uint8_t
-poly_eval(const uint8_t *poly, uint8_t x, int len)
+/* Evaluate each interleaved block at each root of the generator polynomial
+ * using Horner's method, all the blocks and roots in the same pass so that the
+ * evaluations do not have to wait for each other */
+static void
+syndromes_generic(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data)
+{
+	int i, j, n;
+
+	memset(syndromes, 0, RS_T * sizeof(*syndromes));
+	for (n=RS_N-1; n>=0; n--) {
+		for (i=0; i<RS_T; i++) {
+			for (j=0; j<INTERLEAVING; j++) {
+				syndromes[i][j] = gfmul(syndromes[i][j], _zeroes[i]) ^ data[n*INTERLEAVING + j];
+			}
+		}
+	}
+}
+
+#ifdef ARCH_X86
+/* Multiply each byte by the constant whose split-nibble tables are given */
+TARGET_SSSE3 static inline __m128i
+gfmul_ssse3(__m128i x, __m128i lo, __m128i hi)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+
+	return _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(x, nibble)),
+	                     _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(x, 4), nibble)));
+}
+
+/* Each lane accumulates the positions of one block that are equal modulo 4,
+ * Horner's method going 4 positions at a time, multiplying by the 4th power of
+ * the root. The 4 partial sums of each block are then combined by multiplying
+ * them by the root raised to their position modulo 4 */
+TARGET_SSSE3 static void
+syndromes_ssse3(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data)
 {
-	uint8_t ret;
+	uint8_t last[16];
+	__m128i acc[4], lo[4], hi[4], tail, vec, sum;
+	uint32_t result;
+	int i, k, m;
+
+	/* Loading the last group would read past the end of the VCDU: pad it with
+	 * zeroes, the coefficients past the end of the blocks */
+	memset(last, 0, sizeof(last));
+	memcpy(last, data + 16*(SYNDROME_GROUPS-1), RS_N*INTERLEAVING - 16*(SYNDROME_GROUPS-1));
+	tail = _mm_loadu_si128((__m128i*)last);
+
+	for (i=0; i<RS_T; i+=4) {
+		for (k=0; k<4; k++) {
+			lo[k] = _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][3][0]);
+			hi[k] = _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][3][1]);
+			acc[k] = tail;
+		}
+
+		for (m=SYNDROME_GROUPS-2; m>=0; m--) {
+			vec = _mm_loadu_si128((__m128i*)(data + 16*m));
+			for (k=0; k<4; k++) {
+				acc[k] = _mm_xor_si128(gfmul_ssse3(acc[k], lo[k], hi[k]), vec);
+			}
+		}
 
-	ret = 0;
-	for (len--; len>=0; len--) {
-		ret = gfmul(ret, x) ^ poly[len];
+		for (k=0; k<4; k++) {
+			sum = acc[k];
+			sum = _mm_xor_si128(sum, _mm_srli_si128(gfmul_ssse3(acc[k],
+			                    _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][0][0]),
+			                    _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][0][1])), 4));
+			sum = _mm_xor_si128(sum, _mm_srli_si128(gfmul_ssse3(acc[k],
+			                    _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][1][0]),
+			                    _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][1][1])), 8));
+			sum = _mm_xor_si128(sum, _mm_srli_si128(gfmul_ssse3(acc[k],
+			                    _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][2][0]),
+			                    _mm_loadu_si128((__m128i*)_syndrome_mul[i+k][2][1])), 12));
+
+			result = _mm_cvtsi128_si32(sum);
+			memcpy(syndromes[i+k], &result, sizeof(result));
+		}
 	}
+}
+
+/* Same as gfmul_ssse3(), with a different constant in each half */
+TARGET_AVX2 static inline __m256i
+gfmul_avx2(__m256i x, __m256i lo, __m256i hi)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
 
-	return ret;
+	return _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(x, nibble)),
+	                        _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble)));
 }
 
+/* Load the tables of two consecutive roots into the two halves of a register */
+TARGET_AVX2 static inline __m256i
+load_tables_avx2(int root, int power, int nibble)
+{
+	return _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((__m128i*)_syndrome_mul[root][power-1][nibble])),
+			_mm_loadu_si128((__m128i*)_syndrome_mul[root+1][power-1][nibble]), 1);
+}
+
+/* Same as syndromes_ssse3(), with two roots per register */
+TARGET_AVX2 static void
+syndromes_avx2(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data)
+{
+	uint8_t last[16];
+	__m256i acc[4], lo[4], hi[4], tail, vec, sum;
+	uint32_t result;
+	int i, k, m;
+
+	memset(last, 0, sizeof(last));
+	memcpy(last, data + 16*(SYNDROME_GROUPS-1), RS_N*INTERLEAVING - 16*(SYNDROME_GROUPS-1));
+	tail = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)last));
+
+	for (i=0; i<RS_T; i+=8) {
+		for (k=0; k<4; k++) {
+			lo[k] = load_tables_avx2(i+2*k, 4, 0);
+			hi[k] = load_tables_avx2(i+2*k, 4, 1);
+			acc[k] = tail;
+		}
+
+		for (m=SYNDROME_GROUPS-2; m>=0; m--) {
+			vec = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)(data + 16*m)));
+			for (k=0; k<4; k++) {
+				acc[k] = _mm256_xor_si256(gfmul_avx2(acc[k], lo[k], hi[k]), vec);
+			}
+		}
+
+		for (k=0; k<4; k++) {
+			sum = acc[k];
+			sum = _mm256_xor_si256(sum, _mm256_srli_si256(gfmul_avx2(acc[k],
+			                       load_tables_avx2(i+2*k, 1, 0), load_tables_avx2(i+2*k, 1, 1)), 4));
+			sum = _mm256_xor_si256(sum, _mm256_srli_si256(gfmul_avx2(acc[k],
+			                       load_tables_avx2(i+2*k, 2, 0), load_tables_avx2(i+2*k, 2, 1)), 8));
+			sum = _mm256_xor_si256(sum, _mm256_srli_si256(gfmul_avx2(acc[k],
+			                       load_tables_avx2(i+2*k, 3, 0), load_tables_avx2(i+2*k, 3, 1)), 12));
+
+			result = _mm256_cvtsi256_si32(sum);
+			memcpy(syndromes[i+2*k], &result, sizeof(result));
+			result = _mm256_extract_epi32(sum, 4);
+			memcpy(syndromes[i+2*k+1], &result, sizeof(result));
+		}
+	}
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+/* Multiply each byte by the constant whose split-nibble tables are given */
+static inline uint8x16_t
+gfmul_neon(uint8x16_t x, uint8x16_t lo, uint8x16_t hi)
+{
+	return veorq_u8(vqtbl1q_u8(lo, vandq_u8(x, vdupq_n_u8(0x0F))),
+	                vqtbl1q_u8(hi, vshrq_n_u8(x, 4)));
+}
+
+/* Same as syndromes_ssse3() */
 static void
-poly_deriv(uint8_t *dst, const uint8_t *poly, int len)
+syndromes_neon(uint8_t syndromes[RS_T][INTERLEAVING], const uint8_t *data)
 {
-	int i, j;
+	const uint8x16_t zero = vdupq_n_u8(0);
+	uint8_t last[16];
+	uint8x16_t acc[4], lo[4], hi[4], tail, vec, sum;
+	uint32_t result;
+	int i, k, m;
+
+	memset(last, 0, sizeof(last));
+	memcpy(last, data + 16*(SYNDROME_GROUPS-1), RS_N*INTERLEAVING - 16*(SYNDROME_GROUPS-1));
+	tail = vld1q_u8(last);
+
+	for (i=0; i<RS_T; i+=4) {
+		for (k=0; k<4; k++) {
+			lo[k] = vld1q_u8(_syndrome_mul[i+k][3][0]);
+			hi[k] = vld1q_u8(_syndrome_mul[i+k][3][1]);
+			acc[k] = tail;
+		}
 
-	for (i=1; i<len; i++) {
-		dst[i-1] = 0;
-		for (j=0; j<i; j++) {
-			dst[i-1] ^= poly[i];
+		for (m=SYNDROME_GROUPS-2; m>=0; m--) {
+			vec = vld1q_u8(data + 16*m);
+			for (k=0; k<4; k++) {
+				acc[k] = veorq_u8(gfmul_neon(acc[k], lo[k], hi[k]), vec);
+			}
+		}
+
+		for (k=0; k<4; k++) {
+			sum = acc[k];
+			sum = veorq_u8(sum, vextq_u8(gfmul_neon(acc[k], vld1q_u8(_syndrome_mul[i+k][0][0]),
+			                                        vld1q_u8(_syndrome_mul[i+k][0][1])), zero, 4));
+			sum = veorq_u8(sum, vextq_u8(gfmul_neon(acc[k], vld1q_u8(_syndrome_mul[i+k][1][0]),
+			                                        vld1q_u8(_syndrome_mul[i+k][1][1])), zero, 8));
+			sum = veorq_u8(sum, vextq_u8(gfmul_neon(acc[k], vld1q_u8(_syndrome_mul[i+k][2][0]),
+			                                        vld1q_u8(_syndrome_mul[i+k][2][1])), zero, 12));
+
+			result = vgetq_lane_u32(vreinterpretq_u32_u8(sum), 0);
+			memcpy(syndromes[i+k], &result, sizeof(result));
 		}
 	}
 }
+#endif
 
 static void
 poly_mul(uint8_t *dst, const uint8_t *poly1, const uint8_t *poly2, int len_1, int len_2)
@@ -230,7 +516,7 @@ gfmul(uint8_t x, uint8_t y)
 		return 0;
 	}
 
-	return _alpha[(_logtable[x] + _logtable[y]) % RS_N];
+	return _alpha[_logtable[x] + _logtable[y]];
 }
 
 static uint8_t
@@ -240,12 +526,6 @@ gfdiv(uint8_t x, uint8_t y)
 		return 0;
 	}
 
-	return _alpha[(_logtable[x] - _logtable[y] + RS_N) % RS_N];
-}
-
-static uint8_t
-gfpow(uint8_t x, int exp)
-{
-	return x == 0 ? 0 : _alpha[(_logtable[x] * exp) % RS_N];
+	return _alpha[_logtable[x] + RS_N - _logtable[y]];
 }
 /* }}} */
@@ -29,4 +29,12 @@ void rs_init();
  */
 int rs_fix(Vcdu *c);
 
+/**
+ * Get the name of the kernel used to compute the syndromes, selected at runtime
+ * based on the CPU features
+ *
+ * @return a string describing the kernel
+ */
+const char *rs_kernel_name();
+
 #endif /* rs_h */
@@ -1,8 +1,14 @@
-#ifdef __ARM_NEON
-#include <arm_neon.h>
-#endif
 #include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include "cpu.h"
+#ifdef ARCH_NEON
+#include <arm_neon.h>
+#endif
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
 #ifdef __ARM_FEATURE_SIMD32
 #include "math/arm_simd32.h"
 #endif
@@ -10,28 +16,120 @@
 #include "utils.h"
 #include "viterbi.h"
 
-#define NEXT_DEPTH(x) (((x) + 1) % LEN(_prev))
-#define PREV_DEPTH(x) (((x) - 1 + LEN(_prev)) % LEN(_prev))
+#define NEXT_DEPTH(x) (((x) + 1) % MEM_DEPTH)
+#define PREV_DEPTH(x) (((x) - 1 + MEM_DEPTH) % MEM_DEPTH)
+#define PREV_STATE(state, decisions) \
+	((((state) << 1) | ((decisions) >> ((state) & (NUM_STATES/2 - 1)) & 1)) & (NUM_STATES - 1))
+#define PREV_STATE_LANE(state, decisions, lane) \
+	((((state) << 1) | ((decisions)[(state) & (NUM_STATES/2 - 1)] >> (lane) & 1)) & (NUM_STATES - 1))
+#define CHUNK_BYTES (MEM_BACKTRACE >> 3)   /* Bytes decoded for every traceback */
+#define CHUNK_SYMBOLS (2 * MEM_BACKTRACE)  /* Soft symbols consumed for every traceback */
 #define BETTER_METRIC(x, y) ((x) > (y))    /* Higher metric is better */
+#define METRIC8_SHIFT 3                     /* Local metric downscaling in 8-bit mode */
 #define POLY_TOP_BITS ((G1 >> (K-1) & 1) << 1 | (G2 >> (K-1)))
 #define TWIN_METRIC(metric, x, y) (\
 	POLY_TOP_BITS == 0x0 ? (metric) : \
 	POLY_TOP_BITS == 0x1 ? (metric)-2*(x) : \
 	POLY_TOP_BITS == 0x2 ? (metric)-2*(y) : (-metric))
 
+struct _viterbi {
+	/* Backend arrays accessed via pointers defined below */
+	int16_t raw_metrics[NUM_STATES] __attribute__((aligned(32)));
+	int16_t raw_next_metrics[NUM_STATES] __attribute__((aligned(32)));
+
+	int8_t raw_metrics8[NUM_STATES] __attribute__((aligned(32)));
+	int8_t raw_next_metrics8[NUM_STATES] __attribute__((aligned(32)));
+
+	int16_t *metrics, *next_metrics;        /* Pointers to current and previous metrics for each state */
+	int8_t *metrics8, *next_metrics8;       /* Same as above, in 8-bit mode */
+	uint64_t decisions[MEM_DEPTH];          /* Trellis diagram, one bit per pair of states sharing the same predecessor */
+	int depth;                              /* Current memory depth in the trellis array */
+
+	int int8;                               /* Whether 8-bit metrics are in use */
+	int norm;                               /* Sum of the offsets removed from the 8-bit metrics */
+
+	uint64_t block[MEM_START + VITERBI_BLOCK];  /* Decisions since the last traceback in block mode */
+	int block_len;                              /* Number of decisions in block[] */
+};
+
+/* State of a group of segments decoded by viterbi_decode_batch(). Arrays are
+ * indexed by [state][lane], so that each state is a contiguous vector */
+typedef struct {
+	int16_t metrics[2][NUM_STATES][VITERBI_BATCH_LANES] __attribute__((aligned(32)));
+	uint16_t decisions[MEM_DEPTH][NUM_STATES/2];    /* One bit per lane */
+	int8_t x[MEM_BACKTRACE][VITERBI_BATCH_LANES], y[MEM_BACKTRACE][VITERBI_BATCH_LANES];
+} ViterbiBatch;
+
+/* Segment of a buffer decoded by viterbi_decode_parallel(), in chunks of
+ * MEM_BACKTRACE bits */
+typedef struct {
+	uint8_t *out;
+	int8_t *in;
+	long from;                  /* Chunk the decoder is positioned at */
+	long start, end;            /* Chunks to write to the output */
+	ViterbiDecoder *vit;
+	ViterbiDecoder *head;       /* Decoder state before chunk start-1 */
+	ViterbiDecoder *tail;       /* Decoder state before chunk end-1 */
+	long metric;
+} Segment;
+
 static int  parity(uint32_t word);
 static int  metric(int x, int y, int coding);
-static void update_metrics(int8_t x, int8_t y, int depth);
-static void backtrace(uint8_t *out, uint8_t state, int depth, int bitskip, int bitcount);
-
-/* Backend arrays accessed via pointers defined below */
-static int16_t _raw_metrics[NUM_STATES];
-static int16_t _raw_next_metrics[NUM_STATES];
-
-static uint8_t _output_lut[NUM_STATES];         /* Encoder output given a state */
-static int16_t *_metrics, *_next_metrics;       /* Pointers to current and previous metrics for each state */
-static uint8_t _prev[MEM_DEPTH][NUM_STATES/2];  /* Trellis diagram (pairs of states share the same predecessor) */
-static int _depth;                              /* Current memory depth in the trellis array */
+static void update_metrics_generic(ViterbiDecoder *vit, int8_t x, int8_t y);
+#if POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0
+static void update_metrics8_generic(ViterbiDecoder *vit, int8_t x, int8_t y);
+#endif
+#if defined(ARCH_NEON) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+TARGET_NEON static void update_metrics8_neon(ViterbiDecoder *vit, int8_t x, int8_t y);
+TARGET_NEON static void update_metrics_neon(ViterbiDecoder *vit, int8_t x, int8_t y);
+TARGET_NEON static void update_metrics2_neon(ViterbiDecoder *vit, int8_t x0, int8_t y0, int8_t x1, int8_t y1);
+TARGET_NEON static inline uint8_t acs_neon(int16x8_t even, int16x8_t odd, int16x8_t local_metrics, uint8x8_t weights, int16x8_t *next_lo, int16x8_t *next_hi);
+TARGET_NEON static inline int16x8_t local_metrics_neon(int8x8_t local_metrics_lut, int state);
+#endif
+#if __ARM_FEATURE_SIMD32 == 1 && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+static void update_metrics_simd32(ViterbiDecoder *vit, int8_t x, int8_t y);
+#endif
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+TARGET_AVX2 static void update_metrics_avx2(ViterbiDecoder *vit, int8_t x, int8_t y);
+TARGET_SSSE3 static void update_metrics_ssse3(ViterbiDecoder *vit, int8_t x, int8_t y);
+TARGET_AVX2 static void update_metrics8_avx2(ViterbiDecoder *vit, int8_t x, int8_t y);
+TARGET_AVX2 static void update_metrics2_avx2(ViterbiDecoder *vit, int8_t x0, int8_t y0, int8_t x1, int8_t y1);
+TARGET_AVX2 static inline __m256i butterfly_avx2(const int16_t *metrics, int16_t *next_metrics, __m256i local_metrics_lut, int state);
+TARGET_AVX2 static inline __m256i acs_avx2(__m256i lo, __m256i hi, __m256i local_metrics, __m256i *next_lo, __m256i *next_hi);
+TARGET_AVX2 static inline __m256i local_metrics_avx2(__m256i local_metrics_lut, int state);
+TARGET_AVX2 static inline uint64_t acs_step_avx2(__m256i *m0, __m256i *m1, __m256i *m2, __m256i *m3,
+                                                 __m256i *m4, __m256i *m5, __m256i *m6, __m256i *m7, __m256i local_metrics_lut);
+TARGET_SSSE3 static inline __m128i butterfly_ssse3(const int16_t *metrics, int16_t *next_metrics, __m128i local_metrics_lut, int state);
+#endif
+static int decode_batch_sequential(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount);
+static int decode_batch_generic(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount);
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+TARGET_AVX2 static int decode_batch_avx2(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount);
+#endif
+static void backtrace_batch(const ViterbiBatch *batch, uint8_t *const *out, int lanes, const uint8_t *best_state, int depth, int offset);
+static void *decode_segment(void *arg);
+static void copy_decoder(ViterbiDecoder *dst, const ViterbiDecoder *src);
+static void init_common();
+static void reset(ViterbiDecoder *vit);
+static inline void swap_metrics(ViterbiDecoder *vit);
+static inline void swap_metrics8(ViterbiDecoder *vit);
+static int  forward(ViterbiDecoder *vit, const int8_t *in, uint8_t *best_state);
+static void save_decisions(const ViterbiDecoder *vit, uint64_t *dst, int count);
+static void backtrace(ViterbiDecoder *vit, uint8_t *out, uint8_t state, int bitskip, int bitcount);
+static void backtrace_block(const ViterbiDecoder *vit, uint8_t *out, uint8_t state, int bitskip, int bitcount);
+
+static uint8_t _output_lut[NUM_STATES] __attribute__((aligned(32))); /* Encoder output given a state */
+static uint8_t _pair_lut[NUM_STATES/2] __attribute__((aligned(32)));  /* Encoder output to next state 2*(i/2), given in=0 */
+static ViterbiDecoder _default;                 /* Instance used by viterbi_init()/viterbi_decode() */
+
+/* Add-compare-select kernel, selected at runtime based on the CPU features */
+static void (*_update_metrics)(ViterbiDecoder *vit, int8_t x, int8_t y);
+static void (*_update_metrics8)(ViterbiDecoder *vit, int8_t x, int8_t y);
+static void (*_update_metrics2)(ViterbiDecoder *vit, int8_t x0, int8_t y0, int8_t x1, int8_t y1);
+static int (*_decode_batch)(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount);
+static const char *_kernel_name;
+static const char *_kernel8_name;
+static int _radix4 = 0;                         /* Whether radix-4 kernels can be selected */
 
 uint32_t
 conv_encode_u32(uint64_t *output, uint32_t state, uint32_t data)
@@ -55,233 +153,398 @@ conv_encode_u32(uint64_t *output, uint32_t state, uint32_t data)
 void
 viterbi_init()
 {
-	int i, input, state, next_state, output;
+	init_common();
+	reset(&_default);
+}
 
-	/* Precompute the output given a state and an input */
-	for (state=0; state<NUM_STATES; state++) {
-		input = 0;      /* Output for input=1 is _output_lut[state] ^ POLY_TOP_BITS */
-		next_state = (state >> 1) | (input << (K-1));
-		output = parity(next_state & G1) << 1 | parity(next_state & G2);
+ViterbiDecoder*
+viterbi_decoder_init()
+{
+	ViterbiDecoder *vit;
 
-		/* The ARM SIMD32 optimized algorithm stores the local metrics in a
-		 * single uint32_t, so the output computed here is used as a shift value
-		 * rather than an index in an array. For this reason, [0, 1, 2, 3]
-		 * indices become [0, 8, 16, 24] shifts */
-#if defined(__ARM_FEATURE_SIMD32) && !defined(__ARM_NEON)
-		_output_lut[state] = output << 3;
-#else
-		_output_lut[state] = output;
-#endif
-	}
+	/* The lookup tables and the kernel are shared by all decoders */
+	if (!_update_metrics) init_common();
 
-	/* Initialize current Viterbi depth */
-	_depth = 0;
+	/* Metrics must be aligned for the SIMD kernels to be able to use them */
+	if (posix_memalign((void**)&vit, 32, sizeof(*vit))) return NULL;
+	vit->int8 = 0;
+	reset(vit);
 
-	/* Initialize state metrics in the backtrack memory */
-	for (i=0; i<NUM_STATES; i++) {
-		_raw_metrics[i] = 0;
-	}
+	return vit;
+}
 
-	/* Bind metric arrays to the Viterbi struct */
-	_metrics = _raw_metrics;
-	_next_metrics = _raw_next_metrics;
+void
+viterbi_decoder_free(ViterbiDecoder *vit)
+{
+	free(vit);
+}
+
+int
+viterbi_decoder_set_int8(ViterbiDecoder *vit, int enable)
+{
+	if (enable && !_update_metrics8) return 1;
+
+	vit->int8 = enable;
+	reset(vit);
+	return 0;
+}
+
+int
+viterbi_set_int8(int enable)
+{
+	return viterbi_decoder_set_int8(&_default, enable);
 }
 
+const char*
+viterbi_kernel_name()
+{
+	return _default.int8 ? _kernel8_name : _kernel_name;
+}
+
+void
+viterbi_set_radix4(int enable)
+{
+	_radix4 = enable;
+}
 
 int
 viterbi_decode(uint8_t *restrict out, int8_t *restrict soft_cadu, int bytecount)
 {
-	int i;
-	int best_metric;
+	return viterbi_decoder_decode(&_default, out, soft_cadu, bytecount);
+}
+
+int
+viterbi_decoder_decode(ViterbiDecoder *vit, uint8_t *restrict out, int8_t *restrict soft_cadu, int bytecount)
+{
 	int total_metric;
 	uint8_t best_state;
-	int8_t x, y;
 
 	assert(!(bytecount % (MEM_BACKTRACE>>3)));
 
 	total_metric = 0;
 	for(; bytecount > 0; bytecount -= MEM_BACKTRACE >> 3) {
-		/* Viterbi forward step */
-		for (i=MEM_START; i<(int)MEM_DEPTH; i++) {
-			_depth = NEXT_DEPTH(_depth);
+		total_metric += forward(vit, soft_cadu, &best_state);
+		soft_cadu += CHUNK_SYMBOLS;
 
-			y = *soft_cadu++;
-			x = *soft_cadu++;
+		/* Backtrace from the best state and write bits */
+		backtrace(vit, out, best_state, MEM_START, MEM_BACKTRACE);
+		out += MEM_BACKTRACE >> 3;
+	}
 
-			update_metrics(-x, -y, _depth);
-		}
+	return total_metric;
+}
 
-		/* Find the state with the best metric */
-		best_state = 0;
-		best_metric = _metrics[0];
-		for (i=1; i<NUM_STATES; i++) {
-			if (BETTER_METRIC(_metrics[i], best_metric)) {
-				best_metric = _metrics[i];
-				best_state = i;
-			}
-		}
 
-		/* Resize metrics to prevent overflows */
-		for (i=0; i<NUM_STATES; i++) {
-			_metrics[i] -= best_metric;
-		}
+int
+viterbi_decoder_advance(ViterbiDecoder *vit, int8_t *restrict soft_cadu, int bytecount)
+{
+	int total_metric;
+	uint8_t best_state;
+
+	assert(!(bytecount % (MEM_BACKTRACE>>3)));
+	assert(vit->block_len + 8*bytecount <= (int)(MEM_START + VITERBI_BLOCK));
 
-		/* Update total metric */
-		total_metric += 2 * ((127 * MEM_BACKTRACE) - best_metric);
+	total_metric = 0;
+	for(; bytecount > 0; bytecount -= MEM_BACKTRACE >> 3) {
+		total_metric += forward(vit, soft_cadu, &best_state);
+		soft_cadu += CHUNK_SYMBOLS;
 
-		/* Backtrace from the best state and write bits */
-		backtrace(out, best_state, _depth, MEM_START, MEM_BACKTRACE);
-		out += MEM_BACKTRACE >> 3;
+		/* Keep the decisions around until the next traceback */
+		save_decisions(vit, vit->block + vit->block_len, MEM_BACKTRACE);
+		vit->block_len += MEM_BACKTRACE;
 	}
 
 	return total_metric;
 }
 
+int
+viterbi_decoder_decode_block(ViterbiDecoder *vit, uint8_t *restrict out, int8_t *restrict soft_cadu, int bytecount)
+{
+	int total_metric;
+	int bitcount;
+	uint8_t best_state;
+
+	total_metric = viterbi_decoder_advance(vit, soft_cadu, bytecount);
 
-/* Static functions {{{ */
-static int
-parity(uint32_t word)
+	/* Metrics are renormalized after every forward pass, so the best state is
+	 * the first one whose metric is 0 */
+	for (best_state=0; vit->int8 ? vit->metrics8[best_state] : vit->metrics[best_state]; best_state++);
+
+	/* Single traceback over all the bits since the previous one. The last
+	 * MEM_START decisions are kept, since they are needed to converge to the
+	 * first bits of the next block */
+	bitcount = vit->block_len - MEM_START;
+	if (bitcount > 0) {
+		backtrace_block(vit, out, best_state, MEM_START, bitcount);
+		memmove(vit->block, vit->block + bitcount, MEM_START * sizeof(*vit->block));
+		vit->block_len = MEM_START;
+	}
+
+	return total_metric;
+}
+
+int
+viterbi_advance(int8_t *restrict soft_cadu, int bytecount)
 {
-	/* From bit twiddling hacks */
-	word ^= (word >> 1);
-	word ^= (word >> 2);
-	word = (word & 0x11111111) * 0x11111111;
-	return (word >> 28) & 0x1;
+	return viterbi_decoder_advance(&_default, soft_cadu, bytecount);
 }
 
-static void
-update_metrics(int8_t x, int8_t y, int depth)
+int
+viterbi_decode_block(uint8_t *restrict out, int8_t *restrict soft_cadu, int bytecount)
 {
-	int16_t *const metrics = _metrics;
-	int16_t *const next_metrics = _next_metrics;
-	uint8_t *const prev_state = _prev[depth];
-	uint8_t state;
+	return viterbi_decoder_decode_block(&_default, out, soft_cadu, bytecount);
+}
 
-#if defined(__ARM_NEON) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
-	const int8_t local_metrics[4] = {metric(x, y, 0), metric(x, y, 1),
-	                                  metric(x, y, 2), metric(x, y, 3)};
-	uint8_t start_states[] = {0, 2, 4, 6, 8, 10, 12, 14};
 
-	int16x8x2_t deint;
-	int16x8_t best, next_metrics_vec;
-	int16x8_t step_dup;
+int
+viterbi_decode_batch(uint8_t *const *out, int8_t *const *in, int *metrics, int count, int bytecount)
+{
+	ViterbiBatch *batch;
+	int lanes;
 
-	uint16x8_t rev_compare;
-	uint8x8_t states, prev;
-	int8x8_t cost_vec;
-	int16x8_t metrics_vec;
+	assert(!(bytecount % (MEM_BACKTRACE>>3)));
 
-	/* Load initial states and local metrics. States is just a collection of all
-	 * the even states currently being considered */
-	states = vld1_u8(start_states);
-	const int8x8_t local_metrics_lut = vld1_s8(local_metrics);
+	if (!_decode_batch) init_common();
+	if (posix_memalign((void**)&batch, 32, sizeof(*batch))) return 1;
 
-	for (state=0; state<NUM_STATES/2; state+=8) {
-		/* Load metrics for 8 states and their twins, and compute the best ones */
-		deint = vld2q_s16(&metrics[state << 1]);
-		best = BETTER_METRIC(1, 0) != 0
-			? vmaxq_s16(deint.val[0], deint.val[1])
-			: vminq_s16(deint.val[0], deint.val[1]);
-		rev_compare = BETTER_METRIC(1, 0) != 0
-			? vcltq_s16(deint.val[0], deint.val[1])
-			: vcgtq_s16(deint.val[0], deint.val[1]);
-
-		/* Collect previous states based on which ones had the best metric:
-		 * start_state[i] if best was in [0], else start_state[i] + 1 */
-		prev = vadd_u8(states, vand_u8(vmov_n_u8(1), vqmovn_u16(rev_compare)));
-		vst1_u8(&prev_state[state], prev);
-
-		/* Get the local metrics based on the output LUT. */
-		cost_vec = vld1_s8(&_output_lut[state<<1]);
-		metrics_vec = vmovl_s8(vtbl1_s8(local_metrics_lut, cost_vec));
-		metrics_vec = vuzpq_s16(metrics_vec, metrics_vec).val[0];
+	for (; count > 0; count -= lanes) {
+		lanes = MIN(count, VITERBI_BATCH_LANES);
+		if (_decode_batch(batch, out, in, metrics, lanes, bytecount)) {
+			free(batch);
+			return 1;
+		}
 
-		/* Update path metrics */
-		next_metrics_vec = metrics_vec;           /* Load #1: lm0, lm2, ... */
-		next_metrics_vec = vaddq_s16(next_metrics_vec, best);
-		vst1q_s16(&next_metrics[state], next_metrics_vec);
+		out += lanes;
+		in += lanes;
+		if (metrics) metrics += lanes;
+	}
 
-		/* Derive new metrics from old metrics. TODO implement for other G1,G2 values*/
-		metrics_vec = POLY_TOP_BITS == 0x00 ? metrics_vec
-		            : POLY_TOP_BITS == 0x03 ? vnegq_s16(metrics_vec)
-		            : metrics_vec;
+	free(batch);
+	return 0;
+}
 
-		next_metrics_vec = metrics_vec;           /* Load #2: lm1, lm3, ... */
-		next_metrics_vec = vaddq_s16(next_metrics_vec, best);
-		vst1q_s16(&next_metrics[state + (1<<(K-1))], next_metrics_vec);
 
-		/* Go to the next state set */
-		states = vadd_u8(states, vmov_n_u8(2*LEN(start_states)));
+int
+viterbi_decode_parallel(uint8_t *out, int8_t *in, long bytecount, int threads, long *metric)
+{
+	Segment *segments;
+	pthread_t *tids;
+	long chunks, per_segment;
+	int i, spawned, ret;
+
+	assert(!(bytecount % CHUNK_BYTES));
+
+	if (!_update_metrics) init_common();
+
+	/* Don't bother splitting if the warm-up would take a significant portion
+	 * of each segment's decoding time */
+	chunks = bytecount / CHUNK_BYTES;
+	threads = MAX(1, MIN(threads, chunks / (4 * VITERBI_WARMUP / MEM_BACKTRACE)));
+	per_segment = MAX(1, (chunks + threads - 1) / threads);
+	threads = MAX(1, (chunks + per_segment - 1) / per_segment);
+
+	segments = calloc(threads, sizeof(*segments));
+	tids = calloc(threads, sizeof(*tids));
+	ret = !segments || !tids;
+
+	for (i=0; i<threads && !ret; i++) {
+		segments[i].out = out;
+		segments[i].in = in;
+		segments[i].start = i * per_segment;
+		segments[i].end = MIN(chunks, (i+1) * per_segment);
+		segments[i].from = MAX(0, segments[i].start - 1 - VITERBI_WARMUP / MEM_BACKTRACE);
+
+		segments[i].vit = viterbi_decoder_init();
+		segments[i].head = viterbi_decoder_init();
+		segments[i].tail = viterbi_decoder_init();
+		ret |= !segments[i].vit || !segments[i].head || !segments[i].tail;
 	}
-#elif __ARM_FEATURE_SIMD32 == 1 && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
-	const uint32_t local_metrics = (uint8_t)metric(x, y, 0)
-	                             | ((uint8_t)metric(x, y, 1) << 8)
-	                             | ((uint8_t)metric(x, y, 2) << 16)
-	                             | ((uint8_t)metric(x, y, 3) << 24);
 
-	int16_t lm0, lm1, lm2, lm3;
-	uint8_t ns0, ns1, ns2, ns3;
+	/* Decode all segments in parallel. If a thread cannot be created, decode
+	 * the remaining segments in this thread instead */
+	for (spawned=0; spawned<threads && !ret; spawned++) {
+		if (pthread_create(&tids[spawned], NULL, decode_segment, &segments[spawned])) break;
+	}
+	for (i=spawned; i<threads && !ret; i++) {
+		decode_segment(&segments[i]);
+	}
+	for (i=0; i<spawned; i++) {
+		pthread_join(tids[i], NULL);
+	}
 
-	uint32_t metric02, metric13;
-	uint32_t metric_tmp;
-	uint32_t best01_23, prev01_23, lms;
-	uint32_t state_vec;
+	/* Segments are only valid if the metrics at the end of their warm-up match
+	 * the ones of the previous segment at the same point. The decisions made
+	 * after that point, and the bits traced back from them, will then be the
+	 * same as the sequential decoder's. Otherwise, decode the segment again
+	 * starting from the previous segment's state */
+	for (i=1; i<threads && !ret; i++) {
+		if (memcmp(segments[i].head->metrics, segments[i-1].tail->metrics, NUM_STATES * sizeof(int16_t))) {
+			copy_decoder(segments[i].vit, segments[i-1].tail);
+			segments[i].from = segments[i].start - 1;
+			decode_segment(&segments[i]);
+		}
+	}
 
-	for (state=0; state<NUM_STATES/2; state+=2) {
-		/* Compute the two possible next states */
-		ns0 = state;
-		ns1 = state + (1 << (K-1));
-		ns2 = ns0 + 1;
-		ns3 = ns1 + 1;
+	if (metric) {
+		*metric = 0;
+		for (i=0; i<threads && !ret; i++) {
+			*metric += segments[i].metric;
+		}
+	}
 
-		state_vec = (state<<1) << 16 | (state<<1) + 2;
+	for (i=0; segments && i<threads; i++) {
+		viterbi_decoder_free(segments[i].vit);
+		viterbi_decoder_free(segments[i].head);
+		viterbi_decoder_free(segments[i].tail);
+	}
+	free(segments);
+	free(tids);
 
-		/* Fetch the metrics of the two possible predecessors and their twins */
-		metric02 = *(uint32_t*)&metrics[state<<1];
-		metric13 = *(uint32_t*)&metrics[(state<<1)+2];
+	return ret;
+}
 
-		/* Combine them to prepare for some SIMD magic */
-		metric_tmp = __pkhbt(metric13, metric02, 16);
-		metric13 = __pkhtb(metric02, metric13, 16);
-		metric02 = metric_tmp;
 
-		/* Compute best metric and prev states */
-		__ssub16(metric02, metric13);
-		best01_23 = BETTER_METRIC(1, 0) != 0
-			? __sel(metric02, metric13)
-			: __sel(metric13, metric02);
-		prev01_23 = BETTER_METRIC(1, 0) != 0
-			? __ssub16(state_vec, __sel(0, ~0))
-			: __ssub16(state_vec, __sel(~0, 0));  /* ~0 is immediate encodable, 0x00010001 is not */
+/* Static functions {{{ */
+static void
+init_common()
+{
+	int input, state, next_state, output;
 
-		prev_state[ns0] = prev01_23 & 0xFF;
-		prev_state[ns2] = prev01_23 >> 16;
+	/* Precompute the output given a state and an input */
+	for (state=0; state<NUM_STATES; state++) {
+		input = 0;      /* Output for input=1 is _output_lut[state] ^ POLY_TOP_BITS */
+		next_state = (state >> 1) | (input << (K-1));
+		output = parity(next_state & G1) << 1 | parity(next_state & G2);
 
-		/* Compute the metrics of the ns0/ns1/ns2/ns3 transitions */
-		lm0 = (int8_t)((local_metrics >> _output_lut[state<<1]) & 0xFF);
-		lm1 = TWIN_METRIC(lm0, x, y);               /* metric to ns0/1 given in=1 */
-		lm2 = lm1;                                  /* metric to ns2/3 given in=0 */
-		lm3 = TWIN_METRIC(lm2, x, y);               /* metric to ns2/3 given in=1 */
+		_output_lut[state] = output;
+	}
 
-		/* Save new metrics */
-		lms = (lm0<<16) + lm2;
-		*(uint32_t*)&next_metrics[ns0] = __sadd16(best01_23, lms);
-		lms = POLY_TOP_BITS == 0x00 ? lms
-		    : POLY_TOP_BITS == 0x03 ? (uint32_t)__ssub16(0, (uint32_t)lms)
-		    : (uint32_t)((lm1<<16) + lm3);
-		*(uint32_t*)&next_metrics[ns1] = __sadd16(best01_23, lms);
+	for (state=0; state<NUM_STATES/2; state++) {
+		next_state = state & ~1;
+		_pair_lut[state] = parity(next_state & G1) << 1 | parity(next_state & G2);
+	}
+
+	/* Select the fastest add-compare-select kernel for this CPU */
+	_update_metrics = update_metrics_generic;
+	_kernel_name = "generic";
+#if __ARM_FEATURE_SIMD32 == 1 && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+	_update_metrics = update_metrics_simd32;
+	_kernel_name = "simd32";
+#endif
+#if defined(ARCH_NEON) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+	if (cpu_features() & CPU_NEON) {
+		_update_metrics = update_metrics_neon;
+		_kernel_name = "neon";
+	}
+#endif
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+	if (cpu_features() & CPU_SSSE3) {
+		_update_metrics = update_metrics_ssse3;
+		_kernel_name = "ssse3";
+	}
+	if (cpu_features() & CPU_AVX2) {
+		_update_metrics = update_metrics_avx2;
+		_kernel_name = "avx2";
+	}
+#endif
+
+	/* Radix-4 kernel, used in place of the one above when available */
+	_update_metrics2 = NULL;
+	if (_radix4) {
+#if defined(ARCH_NEON) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+		if (cpu_features() & CPU_NEON) {
+			_update_metrics2 = update_metrics2_neon;
+			_kernel_name = "neon (radix-4)";
+		}
+#endif
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+		if (cpu_features() & CPU_AVX2) {
+			_update_metrics2 = update_metrics2_avx2;
+			_kernel_name = "avx2 (radix-4)";
+		}
+#endif
+	}
+
+	/* 8-bit kernel, only available for the polynomials the vectorized kernels
+	 * support */
+	_update_metrics8 = NULL;
+	_kernel8_name = "none";
+#if POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0
+	_update_metrics8 = update_metrics8_generic;
+	_kernel8_name = "generic";
+#endif
+#if defined(ARCH_NEON) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+	if (cpu_features() & CPU_NEON) {
+		_update_metrics8 = update_metrics8_neon;
+		_kernel8_name = "neon";
+	}
+#endif
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+	if (cpu_features() & CPU_AVX2) {
+		_update_metrics8 = update_metrics8_avx2;
+		_kernel8_name = "avx2";
+	}
+#endif
+
+	/* Batch kernel. Without a vectorized implementation, decoding the segments
+	 * one at a time with a vectorized single-stream kernel is faster */
+	_decode_batch = _update_metrics == update_metrics_generic
+	              ? decode_batch_generic
+	              : decode_batch_sequential;
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+	if (cpu_features() & CPU_AVX2) _decode_batch = decode_batch_avx2;
+#endif
+}
+
+static void
+reset(ViterbiDecoder *vit)
+{
+	int i;
+
+	/* Initialize current Viterbi depth */
+	vit->depth = 0;
+
+	/* Initialize state metrics in the backtrack memory */
+	for (i=0; i<NUM_STATES; i++) {
+		vit->raw_metrics[i] = 0;
+		vit->raw_metrics8[i] = 0;
 	}
-#else
+	memset(vit->decisions, 0, sizeof(vit->decisions));
+	vit->norm = 0;
+	vit->block_len = 0;
+
+	/* Bind metric arrays to the Viterbi struct */
+	vit->metrics = vit->raw_metrics;
+	vit->next_metrics = vit->raw_next_metrics;
+	vit->metrics8 = vit->raw_metrics8;
+	vit->next_metrics8 = vit->raw_next_metrics8;
+}
+
+static int
+parity(uint32_t word)
+{
+	/* From bit twiddling hacks */
+	word ^= (word >> 1);
+	word ^= (word >> 2);
+	word = (word & 0x11111111) * 0x11111111;
+	return (word >> 28) & 0x1;
+}
+
+static void
+update_metrics_generic(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int16_t *const metrics = vit->metrics;
+	int16_t *const next_metrics = vit->next_metrics;
+	uint8_t state;
 
-	#if defined(__ARM_NEON) && !(POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
-	#warn "NEON acceleration unimplemented for the given G1/G2, using default implementation"
-	#endif
 	const int local_metrics[4] = {metric(x, y, 0), metric(x, y, 1),
 	                              metric(x, y, 2), metric(x, y, 3)};
 	int16_t metric0, metric1, metric2, metric3, best01, best23;
 	int16_t lm0, lm1, lm2, lm3;
 	uint8_t ns0, ns1, ns2, ns3, prev01, prev23;
+	uint64_t decisions;
 
+	decisions = 0;
 	for (state=0; state<NUM_STATES/2; state+=2) {
 		/* ns2 and ns3 are very closely related to ns0 and ns1: they have the
 		 * same local metrics as ns1 and ns0 respectively. Computing them here
@@ -307,9 +570,10 @@ update_metrics(int8_t x, int8_t y, int depth)
 		prev23 = BETTER_METRIC(metric2, metric3) ? (state<<1) + 2 : (state<<1) + 3;
 
 		/* ns0 and ns1 have the same ancestor, just different metrics. Save it
-		 * only once for both. Same applies for ns2 and ns3 */
-		prev_state[ns0] = prev01;
-		prev_state[ns2] = prev23;
+		 * only once for both. Same applies for ns2 and ns3. The ancestor is
+		 * always either 2*ns0 or 2*ns0+1, so one bit is enough to describe it */
+		decisions |= (uint64_t)(prev01 & 1) << ns0;
+		decisions |= (uint64_t)(prev23 & 1) << ns2;
 
 		/* Compute the metrics of the ns0/ns1 transitions */
 		lm0 = local_metrics[_output_lut[state<<1]]; /* metric to ns0/1 given in=0 */
@@ -323,43 +587,1132 @@ update_metrics(int8_t x, int8_t y, int depth)
 		next_metrics[ns2] = best23 + lm2;
 		next_metrics[ns3] = best23 + lm3;
 	}
-#endif
+	vit->decisions[vit->depth] = decisions;
 
-	/* Swap metric and next_metrics for the next iteration */
-	_metrics = next_metrics;
-	_next_metrics = metrics;
+	swap_metrics(vit);
 }
 
+#if POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0
+/* Same as update_metrics_generic(), using 8-bit saturating metrics. Local
+ * metrics are scaled down so that the spread between the best and the worst
+ * metrics fits in 8 bits, and the metrics are renormalized at every step so
+ * that the best one is always 0 */
 static void
-backtrace(uint8_t *out, uint8_t state, int depth, int bitskip, int bitcount)
+update_metrics8_generic(ViterbiDecoder *vit, int8_t x, int8_t y)
 {
-	int i, bytecount;
-	uint8_t tmp;
+	int8_t *const metrics = vit->metrics8;
+	int8_t *const next_metrics = vit->next_metrics8;
+	uint8_t state;
 
-	assert(!(bitcount & 0x7));
+	const int local_metrics[4] = {metric(x, y, 0) >> METRIC8_SHIFT, metric(x, y, 1) >> METRIC8_SHIFT,
+	                              metric(x, y, 2) >> METRIC8_SHIFT, metric(x, y, 3) >> METRIC8_SHIFT};
+	int metric0, metric1, metric2, metric3, best01, best23;
+	int lm0, lm1, lm2, lm3;
+	int best;
+	uint8_t ns0, ns1, ns2, ns3;
+	uint64_t decisions;
 
-	/* Backtrace without writing bits */
-	for (; bitskip > 0; bitskip--) {
-		state = _prev[depth][state & ~(1<<(K-1))];
-		depth = PREV_DEPTH(depth);
-	}
+	decisions = 0;
+	best = -128;
+	for (state=0; state<NUM_STATES/2; state+=2) {
+		ns0 = state;
+		ns1 = state + (1 << (K-1));
+		ns2 = ns0 + 1;
+		ns3 = ns1 + 1;
 
-	/* Preemptively advance out: bits are written in reverse order */
-	bytecount = bitcount >> 3;
-	out += bytecount;
+		metric0 = metrics[state<<1];
+		metric1 = metrics[(state<<1)+1];
+		metric2 = metrics[(state<<1)+2];
+		metric3 = metrics[(state<<1)+3];
 
-	/* Backtrace while writing bits */
-	for (;bytecount > 0; bytecount--) {
-		tmp = 0;
-		/* Process each byte separately */
-		for (i=0; i<8; i++) {
-			tmp |= (state >> (K-1)) << i;
-			state = _prev[depth][state & ~(1<<(K-1))];
-			depth = PREV_DEPTH(depth);
-		}
+		best01 = BETTER_METRIC(metric0, metric1) ? metric0 : metric1;
+		best23 = BETTER_METRIC(metric2, metric3) ? metric2 : metric3;
+		decisions |= (uint64_t)!BETTER_METRIC(metric0, metric1) << ns0;
+		decisions |= (uint64_t)!BETTER_METRIC(metric2, metric3) << ns2;
 
-		/* Copy byte to output, then go to the previous byte */
-		*--out = tmp;
+		lm0 = local_metrics[_pair_lut[state]];
+		lm1 = TWIN_METRIC(lm0, x, y);
+		lm2 = lm1;
+		lm3 = TWIN_METRIC(lm2, x, y);
+
+		next_metrics[ns0] = MAX(-128, MIN(127, best01 + lm0));
+		next_metrics[ns1] = MAX(-128, MIN(127, best01 + lm1));
+		next_metrics[ns2] = MAX(-128, MIN(127, best23 + lm2));
+		next_metrics[ns3] = MAX(-128, MIN(127, best23 + lm3));
+
+		best = MAX(best, MAX(MAX(next_metrics[ns0], next_metrics[ns1]),
+		                     MAX(next_metrics[ns2], next_metrics[ns3])));
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	/* Renormalize */
+	for (state=0; state<NUM_STATES; state++) {
+		next_metrics[state] = MAX(-128, next_metrics[state] - best);
+	}
+	vit->norm += best;
+
+	swap_metrics8(vit);
+}
+#endif
+
+#if defined(ARCH_NEON) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+TARGET_NEON static void
+update_metrics_neon(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int16_t *const metrics = vit->metrics;
+	int16_t *const next_metrics = vit->next_metrics;
+	uint8_t state;
+	const int8_t local_metrics[8] = {metric(x, y, 0), metric(x, y, 1),
+	                                 metric(x, y, 2), metric(x, y, 3)};
+	const uint8_t decision_weights[] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+	int16x8x2_t deint;
+	int16x8_t next_lo, next_hi;
+	uint8x8_t weights;
+	uint64_t decisions;
+
+	/* Load bit weights and local metrics */
+	weights = vld1_u8(decision_weights);
+	const int8x8_t local_metrics_lut = vld1_s8(local_metrics);
+
+	decisions = 0;
+
+	for (state=0; state<NUM_STATES/2; state+=8) {
+		/* Load metrics for 8 states and their twins, and compute the best ones */
+		deint = vld2q_s16(&metrics[state << 1]);
+		decisions |= (uint64_t)acs_neon(deint.val[0], deint.val[1],
+		                                local_metrics_neon(local_metrics_lut, state),
+		                                weights, &next_lo, &next_hi) << state;
+
+		vst1q_s16(&next_metrics[state], next_lo);
+		vst1q_s16(&next_metrics[state + (1<<(K-1))], next_hi);
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	swap_metrics(vit);
+}
+
+/* Radix-4 version of update_metrics_neon(): processes two trellis steps at
+ * once, keeping all the metrics in registers in between */
+TARGET_NEON static void
+update_metrics2_neon(ViterbiDecoder *vit, int8_t x0, int8_t y0, int8_t x1, int8_t y1)
+{
+	int16_t *const metrics = vit->metrics;
+	const int8_t local_metrics[2][8] = {
+		{metric(x0, y0, 0), metric(x0, y0, 1), metric(x0, y0, 2), metric(x0, y0, 3)},
+		{metric(x1, y1, 0), metric(x1, y1, 1), metric(x1, y1, 2), metric(x1, y1, 3)}
+	};
+	const uint8_t decision_weights[] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+	int16x8x2_t deint;
+	int16x8_t metrics_vec[NUM_STATES/8], next_metrics_vec[NUM_STATES/8];
+	int8x8_t local_metrics_lut;
+	uint8x8_t weights;
+	uint64_t decisions;
+	int depth, step, i;
+
+	weights = vld1_u8(decision_weights);
+	for (i=0; i<NUM_STATES/8; i++) {
+		metrics_vec[i] = vld1q_s16(&metrics[8*i]);
+	}
+
+	depth = vit->depth;
+	for (step=0; step<2; step++) {
+		local_metrics_lut = vld1_s8(local_metrics[step]);
+
+		/* States [8i, 8i+8) and their twins only depend on metrics_vec[2i]
+		 * and metrics_vec[2i+1] */
+		decisions = 0;
+		for (i=0; i<NUM_STATES/16; i++) {
+			deint = vuzpq_s16(metrics_vec[2*i], metrics_vec[2*i+1]);
+			decisions |= (uint64_t)acs_neon(deint.val[0], deint.val[1],
+			                                local_metrics_neon(local_metrics_lut, 8*i), weights,
+			                                &next_metrics_vec[i], &next_metrics_vec[i + NUM_STATES/16]) << (8*i);
+		}
+		vit->decisions[depth] = decisions;
+		depth = NEXT_DEPTH(depth);
+
+		for (i=0; i<NUM_STATES/8; i++) {
+			metrics_vec[i] = next_metrics_vec[i];
+		}
+	}
+
+	/* Both steps are done, so the metrics can be written back in place */
+	for (i=0; i<NUM_STATES/8; i++) {
+		vst1q_s16(&metrics[8*i], metrics_vec[i]);
+	}
+}
+
+/* Compute the metrics of 8 states and their twins given the metrics of their
+ * even and odd predecessors. Returns one bit per state based on which
+ * predecessor had the best metric: 0 if it was the even one, else 1 */
+__attribute__((always_inline)) TARGET_NEON
+static inline uint8_t
+acs_neon(int16x8_t even, int16x8_t odd, int16x8_t local_metrics, uint8x8_t weights, int16x8_t *next_lo, int16x8_t *next_hi)
+{
+	int16x8_t best;
+	uint16x8_t rev_compare;
+	uint8x8_t prev;
+
+	best = BETTER_METRIC(1, 0) != 0
+		? vmaxq_s16(even, odd)
+		: vminq_s16(even, odd);
+	rev_compare = BETTER_METRIC(1, 0) != 0
+		? vcltq_s16(even, odd)
+		: vcgtq_s16(even, odd);
+
+	/* Pairwise adds of the weighted bits fold them into a single byte */
+	prev = vand_u8(weights, vmovn_u16(rev_compare));
+	prev = vpadd_u8(prev, prev);
+	prev = vpadd_u8(prev, prev);
+	prev = vpadd_u8(prev, prev);
+
+	/* Update path metrics */
+	*next_lo = vaddq_s16(local_metrics, best);
+
+	/* Derive new metrics from old metrics. TODO implement for other G1,G2 values*/
+	local_metrics = POLY_TOP_BITS == 0x00 ? local_metrics
+	              : POLY_TOP_BITS == 0x03 ? vnegq_s16(local_metrics)
+	              : local_metrics;
+	*next_hi = vaddq_s16(local_metrics, best);
+
+	return vget_lane_u8(prev, 0);
+}
+
+/* Get the local metrics of 8 states starting from state, based on the output
+ * LUT */
+__attribute__((always_inline)) TARGET_NEON
+static inline int16x8_t
+local_metrics_neon(int8x8_t local_metrics_lut, int state)
+{
+	int8x8_t cost_vec;
+	int16x8_t metrics_vec;
+
+	cost_vec = vld1_s8((int8_t*)&_output_lut[state<<1]);
+	metrics_vec = vmovl_s8(vtbl1_s8(local_metrics_lut, cost_vec));
+	return vuzpq_s16(metrics_vec, metrics_vec).val[0];
+}
+
+TARGET_NEON static void
+update_metrics8_neon(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int8_t *const metrics = vit->metrics8;
+	int8_t *const next_metrics = vit->next_metrics8;
+	uint8_t state;
+	const int8_t local_metrics[8] = {metric(x, y, 0) >> METRIC8_SHIFT, metric(x, y, 1) >> METRIC8_SHIFT,
+	                                 metric(x, y, 2) >> METRIC8_SHIFT, metric(x, y, 3) >> METRIC8_SHIFT,
+	                                 0, 0, 0, 0};
+	const uint8_t decision_weights[] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	const uint8_t odd_states[] = {0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF};
+
+	int8x16x2_t deint;
+	int8x16_t best, metrics_vec, max_vec;
+	int8x16_t next[8];
+	uint8x16_t weights, odd_mask, rev_compare;
+	uint8x8_t prev;
+	int8x8_t local_metrics_lut, max8;
+	int8_t best_metric;
+	uint64_t decisions;
+	int i;
+
+	weights = vld1q_u8(decision_weights);
+	odd_mask = vld1q_u8(odd_states);
+	local_metrics_lut = vld1_s8(local_metrics);
+
+	decisions = 0;
+	max_vec = vdupq_n_s8(-128);
+	for (state=0, i=0; state<NUM_STATES/2; state+=16, i++) {
+		/* Load metrics for 16 states and their twins, and compute the best ones */
+		deint = vld2q_s8(&metrics[state << 1]);
+		best = vmaxq_s8(deint.val[0], deint.val[1]);
+
+		/* Collect one bit per state, 1 if the odd predecessor was better, and
+		 * fold them into two bytes */
+		rev_compare = vandq_u8(weights, vcleq_s8(deint.val[0], deint.val[1]));
+		prev = vpadd_u8(vget_low_u8(rev_compare), vget_high_u8(rev_compare));
+		prev = vpadd_u8(prev, prev);
+		prev = vpadd_u8(prev, prev);
+		decisions |= (uint64_t)vget_lane_u16(vreinterpret_u16_u8(prev), 0) << state;
+
+		/* Get the local metrics of each pair of states, negating the ones of
+		 * odd states like update_metrics8_generic() does */
+		metrics_vec = vcombine_s8(vtbl1_s8(local_metrics_lut, vreinterpret_s8_u8(vld1_u8(&_pair_lut[state]))),
+		                          vtbl1_s8(local_metrics_lut, vreinterpret_s8_u8(vld1_u8(&_pair_lut[state + 8]))));
+		if (POLY_TOP_BITS == 0x03) metrics_vec = vbslq_s8(odd_mask, vnegq_s8(metrics_vec), metrics_vec);
+
+		/* Update path metrics */
+		next[i] = vqaddq_s8(best, metrics_vec);
+		next[i+4] = POLY_TOP_BITS == 0x00 ? vqaddq_s8(best, metrics_vec)
+		          : vqsubq_s8(best, metrics_vec);
+		max_vec = vmaxq_s8(max_vec, vmaxq_s8(next[i], next[i+4]));
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	/* Find the best metric, then renormalize and store */
+	max8 = vpmax_s8(vget_low_s8(max_vec), vget_high_s8(max_vec));
+	max8 = vpmax_s8(max8, max8);
+	max8 = vpmax_s8(max8, max8);
+	max8 = vpmax_s8(max8, max8);
+	best_metric = vget_lane_s8(max8, 0);
+
+	max_vec = vdupq_n_s8(best_metric);
+	for (i=0; i<8; i++) {
+		vst1q_s8(&next_metrics[16*i], vqsubq_s8(next[i], max_vec));
+	}
+	vit->norm += best_metric;
+
+	swap_metrics8(vit);
+}
+#endif
+
+#if __ARM_FEATURE_SIMD32 == 1 && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+static void
+update_metrics_simd32(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int16_t *const metrics = vit->metrics;
+	int16_t *const next_metrics = vit->next_metrics;
+	uint8_t state;
+	const uint32_t local_metrics = (uint8_t)metric(x, y, 0)
+	                             | ((uint8_t)metric(x, y, 1) << 8)
+	                             | ((uint8_t)metric(x, y, 2) << 16)
+	                             | ((uint8_t)metric(x, y, 3) << 24);
+
+	int16_t lm0, lm1, lm2, lm3;
+	uint8_t ns0, ns1, ns2, ns3;
+
+	uint32_t metric02, metric13;
+	uint32_t metric_tmp;
+	uint32_t best01_23, prev01_23, lms;
+	uint64_t decisions;
+
+	decisions = 0;
+	for (state=0; state<NUM_STATES/2; state+=2) {
+		/* Compute the two possible next states */
+		ns0 = state;
+		ns1 = state + (1 << (K-1));
+		ns2 = ns0 + 1;
+		ns3 = ns1 + 1;
+
+		/* Fetch the metrics of the two possible predecessors and their twins */
+		metric02 = *(uint32_t*)&metrics[state<<1];
+		metric13 = *(uint32_t*)&metrics[(state<<1)+2];
+
+		/* Combine them to prepare for some SIMD magic: the low halfword refers
+		 * to ns0, the high halfword to ns2, matching the order they are stored
+		 * in memory */
+		metric_tmp = __pkhbt(metric02, metric13, 16);
+		metric13 = __pkhtb(metric13, metric02, 16);
+		metric02 = metric_tmp;
+
+		/* Compute best metric and decision bits */
+		__ssub16(metric02, metric13);
+		best01_23 = BETTER_METRIC(1, 0) != 0
+			? __sel(metric02, metric13)
+			: __sel(metric13, metric02);
+		prev01_23 = BETTER_METRIC(1, 0) != 0
+			? __ssub16(0, __sel(0, ~0))
+			: __ssub16(0, __sel(~0, 0));  /* ~0 is immediate encodable, 0x00010001 is not */
+
+		decisions |= (uint64_t)(prev01_23 & 1) << ns0;
+		decisions |= (uint64_t)(prev01_23 >> 16 & 1) << ns2;
+
+		/* Compute the metrics of the ns0/ns1/ns2/ns3 transitions. The local
+		 * metrics are packed in a single uint32_t, so the output is turned
+		 * into a shift: [0, 1, 2, 3] indices become [0, 8, 16, 24] shifts */
+		lm0 = (int8_t)((local_metrics >> (_output_lut[state<<1] << 3)) & 0xFF);
+		lm1 = TWIN_METRIC(lm0, x, y);               /* metric to ns0/1 given in=1 */
+		lm2 = lm1;                                  /* metric to ns2/3 given in=0 */
+		lm3 = TWIN_METRIC(lm2, x, y);               /* metric to ns2/3 given in=1 */
+
+		/* Save new metrics */
+		lms = (uint32_t)lm2 << 16 | (uint16_t)lm0;
+		*(uint32_t*)&next_metrics[ns0] = __sadd16(best01_23, lms);
+		lms = POLY_TOP_BITS == 0x00 ? lms
+		    : POLY_TOP_BITS == 0x03 ? (uint32_t)__ssub16(0, (uint32_t)lms)
+		    : (uint32_t)lm3 << 16 | (uint16_t)lm1;
+		*(uint32_t*)&next_metrics[ns1] = __sadd16(best01_23, lms);
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	swap_metrics(vit);
+}
+#endif
+
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+TARGET_AVX2 static void
+update_metrics_avx2(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int16_t *const metrics = vit->metrics;
+	int16_t *const next_metrics = vit->next_metrics;
+	uint8_t state;
+
+	const __m256i local_metrics_lut = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+			metric(x, y, 0), metric(x, y, 1), metric(x, y, 2), metric(x, y, 3),
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	__m256i take_even[2];
+	uint64_t decisions;
+	int i;
+
+	decisions = 0;
+	for (state=0; state<NUM_STATES/2; state+=32) {
+		/* Handle 32 states at a time, so that their decisions can be collected
+		 * with a single movemask */
+		for (i=0; i<2; i++) {
+			take_even[i] = butterfly_avx2(metrics, next_metrics, local_metrics_lut, state + 16*i);
+		}
+
+		/* Pack the 16-bit masks into bytes, undo the lane interleaving, and
+		 * save one bit per state: 1 if the odd predecessor was better */
+		take_even[0] = _mm256_packs_epi16(take_even[0], take_even[1]);
+		take_even[0] = _mm256_permute4x64_epi64(take_even[0], 0xD8);
+		decisions |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(take_even[0]) << state;
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	swap_metrics(vit);
+}
+
+/* Radix-4 version of update_metrics_avx2(): processes two trellis steps at
+ * once, keeping all the metrics in registers in between */
+TARGET_AVX2 static void
+update_metrics2_avx2(ViterbiDecoder *vit, int8_t x0, int8_t y0, int8_t x1, int8_t y1)
+{
+	int16_t *const metrics = vit->metrics;
+	const __m256i local_metrics_lut0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+			metric(x0, y0, 0), metric(x0, y0, 1), metric(x0, y0, 2), metric(x0, y0, 3),
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i local_metrics_lut1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+			metric(x1, y1, 0), metric(x1, y1, 1), metric(x1, y1, 2), metric(x1, y1, 3),
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	__m256i m0, m1, m2, m3, m4, m5, m6, m7;
+
+	m0 = _mm256_load_si256((__m256i*)&metrics[0]);
+	m1 = _mm256_load_si256((__m256i*)&metrics[16]);
+	m2 = _mm256_load_si256((__m256i*)&metrics[32]);
+	m3 = _mm256_load_si256((__m256i*)&metrics[48]);
+	m4 = _mm256_load_si256((__m256i*)&metrics[64]);
+	m5 = _mm256_load_si256((__m256i*)&metrics[80]);
+	m6 = _mm256_load_si256((__m256i*)&metrics[96]);
+	m7 = _mm256_load_si256((__m256i*)&metrics[112]);
+
+	vit->decisions[vit->depth] = acs_step_avx2(&m0, &m1, &m2, &m3, &m4, &m5, &m6, &m7, local_metrics_lut0);
+	vit->decisions[NEXT_DEPTH(vit->depth)] = acs_step_avx2(&m0, &m1, &m2, &m3, &m4, &m5, &m6, &m7, local_metrics_lut1);
+
+	/* Both steps are done, so the metrics can be written back in place */
+	_mm256_store_si256((__m256i*)&metrics[0], m0);
+	_mm256_store_si256((__m256i*)&metrics[16], m1);
+	_mm256_store_si256((__m256i*)&metrics[32], m2);
+	_mm256_store_si256((__m256i*)&metrics[48], m3);
+	_mm256_store_si256((__m256i*)&metrics[64], m4);
+	_mm256_store_si256((__m256i*)&metrics[80], m5);
+	_mm256_store_si256((__m256i*)&metrics[96], m6);
+	_mm256_store_si256((__m256i*)&metrics[112], m7);
+}
+
+TARGET_SSSE3 static void
+update_metrics_ssse3(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int16_t *const metrics = vit->metrics;
+	int16_t *const next_metrics = vit->next_metrics;
+	uint8_t state;
+
+	const __m128i local_metrics_lut = _mm_setr_epi8(
+			metric(x, y, 0), metric(x, y, 1), metric(x, y, 2), metric(x, y, 3),
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m128i take_even[2];
+	uint64_t decisions;
+	int i;
+
+	decisions = 0;
+	for (state=0; state<NUM_STATES/2; state+=16) {
+		for (i=0; i<2; i++) {
+			take_even[i] = butterfly_ssse3(metrics, next_metrics, local_metrics_lut, state + 8*i);
+		}
+
+		/* Save one bit per state: 1 if the odd predecessor was better */
+		take_even[0] = _mm_packs_epi16(take_even[0], take_even[1]);
+		decisions |= (uint64_t)(uint16_t)~_mm_movemask_epi8(take_even[0]) << state;
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	swap_metrics(vit);
+}
+
+TARGET_AVX2 static void
+update_metrics8_avx2(ViterbiDecoder *vit, int8_t x, int8_t y)
+{
+	int8_t *const metrics = vit->metrics8;
+	int8_t *const next_metrics = vit->next_metrics8;
+	uint8_t state;
+
+	const __m256i local_metrics_lut = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+			metric(x, y, 0) >> METRIC8_SHIFT, metric(x, y, 1) >> METRIC8_SHIFT,
+			metric(x, y, 2) >> METRIC8_SHIFT, metric(x, y, 3) >> METRIC8_SHIFT,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i deinterleave = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+			0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+	const __m256i odd_sign = _mm256_set1_epi16(0xFF01);
+	__m256i lo, hi, even, odd, best, metrics_vec;
+	__m256i next[4], max;
+	uint64_t decisions;
+	int i;
+
+	decisions = 0;
+	max = _mm256_set1_epi8(-128);
+	for (state=0, i=0; state<NUM_STATES/2; state+=32, i++) {
+		/* Load metrics for 32 states and their twins. Split them into even/odd
+		 * bytes within each 128-bit lane, then gather the even and odd halves,
+		 * and finally undo the lane interleaving */
+		lo = _mm256_shuffle_epi8(_mm256_load_si256((__m256i*)&metrics[state << 1]), deinterleave);
+		hi = _mm256_shuffle_epi8(_mm256_load_si256((__m256i*)&metrics[(state << 1) + 32]), deinterleave);
+		even = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(lo, hi), 0xD8);
+		odd = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(lo, hi), 0xD8);
+
+		/* Compute the best metrics, and save one bit per state: 1 if the odd
+		 * predecessor was better. 8-bit masks need no packing */
+		best = _mm256_max_epi8(even, odd);
+		decisions |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(_mm256_cmpgt_epi8(even, odd)) << state;
+
+		/* Get the local metrics of each pair of states, negating the ones of
+		 * odd states like update_metrics8_generic() does */
+		metrics_vec = _mm256_load_si256((__m256i*)&_pair_lut[state]);
+		metrics_vec = _mm256_shuffle_epi8(local_metrics_lut, metrics_vec);
+		if (POLY_TOP_BITS == 0x03) metrics_vec = _mm256_sign_epi8(metrics_vec, odd_sign);
+
+		/* Update path metrics */
+		next[i] = _mm256_adds_epi8(best, metrics_vec);
+		next[i+2] = POLY_TOP_BITS == 0x00 ? _mm256_adds_epi8(best, metrics_vec)
+		          : _mm256_subs_epi8(best, metrics_vec);
+		max = _mm256_max_epi8(max, _mm256_max_epi8(next[i], next[i+2]));
+	}
+	vit->decisions[vit->depth] = decisions;
+
+	/* Find the best metric and broadcast it to all bytes */
+	max = _mm256_max_epi8(max, _mm256_permute2x128_si256(max, max, 0x01));
+	max = _mm256_max_epi8(max, _mm256_shuffle_epi32(max, 0x4E));
+	max = _mm256_max_epi8(max, _mm256_shuffle_epi32(max, 0xB1));
+	max = _mm256_max_epi8(max, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(max, 0xB1), 0xB1));
+	max = _mm256_max_epi8(max, _mm256_or_si256(_mm256_slli_epi16(max, 8), _mm256_srli_epi16(max, 8)));
+	max = _mm256_broadcastb_epi8(_mm256_castsi256_si128(max));
+
+	/* Renormalize and store */
+	for (i=0; i<4; i++) {
+		_mm256_store_si256((__m256i*)&next_metrics[32*i], _mm256_subs_epi8(next[i], max));
+	}
+	vit->norm += (int8_t)_mm256_extract_epi8(max, 0);
+
+	swap_metrics8(vit);
+}
+
+/* Compute the metrics of 16 states and their twins, returning a mask set for
+ * each state whose best predecessor is the even one */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m256i
+butterfly_avx2(const int16_t *metrics, int16_t *next_metrics, __m256i local_metrics_lut, int state)
+{
+	__m256i lo, hi, next_lo, next_hi, take_even;
+
+	lo = _mm256_load_si256((__m256i*)&metrics[state << 1]);
+	hi = _mm256_load_si256((__m256i*)&metrics[(state << 1) + 16]);
+	take_even = acs_avx2(lo, hi, local_metrics_avx2(local_metrics_lut, state), &next_lo, &next_hi);
+	_mm256_store_si256((__m256i*)&next_metrics[state], next_lo);
+	_mm256_store_si256((__m256i*)&next_metrics[state + (1<<(K-1))], next_hi);
+
+	return take_even;
+}
+
+/* Same as butterfly_avx2(), on metrics held in registers: lo and hi are the
+ * metrics of the 32 states preceding states [state, state+16), and the new
+ * metrics of these states and their twins are written to next_lo and next_hi */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m256i
+acs_avx2(__m256i lo, __m256i hi, __m256i local_metrics, __m256i *next_lo, __m256i *next_hi)
+{
+	__m256i even, odd, best, take_even;
+
+	/* Split the metrics into even/odd vectors. Sign-extending each half of a
+	 * 32-bit word and then packing it back into 16-bit words is lossless, and
+	 * the final permute undoes the lane interleaving done by packs */
+	even = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16),
+	                          _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16));
+	odd = _mm256_packs_epi32(_mm256_srai_epi32(lo, 16), _mm256_srai_epi32(hi, 16));
+	even = _mm256_permute4x64_epi64(even, 0xD8);
+	odd = _mm256_permute4x64_epi64(odd, 0xD8);
+
+	/* Compute the best metrics. Ties go to the odd predecessor, just like
+	 * in the scalar implementation */
+	best = BETTER_METRIC(1, 0) != 0
+		? _mm256_max_epi16(even, odd)
+		: _mm256_min_epi16(even, odd);
+	take_even = BETTER_METRIC(1, 0) != 0
+		? _mm256_cmpgt_epi16(even, odd)
+		: _mm256_cmpgt_epi16(odd, even);
+
+	/* Update path metrics, and derive the metrics of the twin states */
+	*next_lo = _mm256_add_epi16(best, local_metrics);
+	*next_hi = POLY_TOP_BITS == 0x00 ? _mm256_add_epi16(best, local_metrics)
+	         : _mm256_sub_epi16(best, local_metrics);
+
+	return take_even;
+}
+
+/* Advance the metrics of all the states, held in registers (mi contains the
+ * metrics of states [16i, 16i+16)), by one step. Returns the decisions */
+__attribute__((always_inline)) TARGET_AVX2
+static inline uint64_t
+acs_step_avx2(__m256i *m0, __m256i *m1, __m256i *m2, __m256i *m3,
+              __m256i *m4, __m256i *m5, __m256i *m6, __m256i *m7, __m256i local_metrics_lut)
+{
+	__m256i n0, n1, n2, n3, n4, n5, n6, n7;
+	__m256i take_even0, take_even1, take_even2, take_even3;
+	uint64_t decisions;
+
+	/* States [16i, 16i+16) and their twins only depend on m(2i) and m(2i+1) */
+	take_even0 = acs_avx2(*m0, *m1, local_metrics_avx2(local_metrics_lut, 0), &n0, &n4);
+	take_even1 = acs_avx2(*m2, *m3, local_metrics_avx2(local_metrics_lut, 16), &n1, &n5);
+	take_even2 = acs_avx2(*m4, *m5, local_metrics_avx2(local_metrics_lut, 32), &n2, &n6);
+	take_even3 = acs_avx2(*m6, *m7, local_metrics_avx2(local_metrics_lut, 48), &n3, &n7);
+
+	/* Same as update_metrics_avx2() */
+	take_even0 = _mm256_permute4x64_epi64(_mm256_packs_epi16(take_even0, take_even1), 0xD8);
+	take_even2 = _mm256_permute4x64_epi64(_mm256_packs_epi16(take_even2, take_even3), 0xD8);
+	decisions = (uint64_t)(uint32_t)~_mm256_movemask_epi8(take_even0)
+	          | (uint64_t)(uint32_t)~_mm256_movemask_epi8(take_even2) << 32;
+
+	*m0 = n0; *m1 = n1; *m2 = n2; *m3 = n3;
+	*m4 = n4; *m5 = n5; *m6 = n6; *m7 = n7;
+
+	return decisions;
+}
+
+/* Get the local metrics of 16 states starting from state, based on the output
+ * LUT, keeping only the ones of even states, sign-extended to 16 bits. Odd
+ * states use the twin metric of the even state before them, like lm2 does in
+ * the scalar implementation */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m256i
+local_metrics_avx2(__m256i local_metrics_lut, int state)
+{
+	__m256i metrics_vec;
+
+	metrics_vec = _mm256_load_si256((__m256i*)&_output_lut[state << 1]);
+	metrics_vec = _mm256_shuffle_epi8(local_metrics_lut, metrics_vec);
+	metrics_vec = _mm256_srai_epi16(_mm256_slli_epi16(metrics_vec, 8), 8);
+	metrics_vec = _mm256_and_si256(metrics_vec, _mm256_set1_epi32(0xFFFF));
+	metrics_vec = POLY_TOP_BITS == 0x00 ? _mm256_or_si256(metrics_vec, _mm256_slli_epi32(metrics_vec, 16))
+	            : _mm256_sub_epi16(metrics_vec, _mm256_slli_epi32(metrics_vec, 16));
+
+	return metrics_vec;
+}
+
+/* Compute the metrics of 8 states and their twins, returning a mask set for
+ * each state whose best predecessor is the even one */
+__attribute__((always_inline)) TARGET_SSSE3
+static inline __m128i
+butterfly_ssse3(const int16_t *metrics, int16_t *next_metrics, __m128i local_metrics_lut, int state)
+{
+	__m128i lo, hi, even, odd, best, take_even;
+	__m128i metrics_vec;
+
+	/* Load metrics for 8 states and their twins, and split them into
+	 * even/odd vectors (see the AVX2 implementation above) */
+	lo = _mm_load_si128((__m128i*)&metrics[state << 1]);
+	hi = _mm_load_si128((__m128i*)&metrics[(state << 1) + 8]);
+	even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16),
+	                       _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+	odd = _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16));
+
+	/* Compute the best metrics */
+	best = BETTER_METRIC(1, 0) != 0
+		? _mm_max_epi16(even, odd)
+		: _mm_min_epi16(even, odd);
+	take_even = BETTER_METRIC(1, 0) != 0
+		? _mm_cmpgt_epi16(even, odd)
+		: _mm_cmpgt_epi16(odd, even);
+
+	/* Get the local metrics based on the output LUT */
+	metrics_vec = _mm_load_si128((__m128i*)&_output_lut[state << 1]);
+	metrics_vec = _mm_shuffle_epi8(local_metrics_lut, metrics_vec);
+	metrics_vec = _mm_srai_epi16(_mm_slli_epi16(metrics_vec, 8), 8);
+	metrics_vec = _mm_and_si128(metrics_vec, _mm_set1_epi32(0xFFFF));
+	metrics_vec = POLY_TOP_BITS == 0x00 ? _mm_or_si128(metrics_vec, _mm_slli_epi32(metrics_vec, 16))
+	            : _mm_sub_epi16(metrics_vec, _mm_slli_epi32(metrics_vec, 16));
+
+	/* Update path metrics */
+	_mm_store_si128((__m128i*)&next_metrics[state], _mm_add_epi16(best, metrics_vec));
+
+	metrics_vec = POLY_TOP_BITS == 0x00 ? _mm_add_epi16(best, metrics_vec)
+	            : _mm_sub_epi16(best, metrics_vec);
+	_mm_store_si128((__m128i*)&next_metrics[state + (1<<(K-1))], metrics_vec);
+
+	return take_even;
+}
+#endif
+
+/* Decode up to VITERBI_BATCH_LANES segments, one per lane. The operations
+ * performed on each lane are exactly the same as in viterbi_decoder_decode(),
+ * with update_metrics() computing a whole trellis step for all the lanes */
+__attribute__((always_inline))
+static inline void
+decode_batch(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount,
+             void (*update_metrics)(const int8_t *x, const int8_t *y, const uint8_t *coding,
+                                    int16_t (*cur)[VITERBI_BATCH_LANES], int16_t (*next)[VITERBI_BATCH_LANES],
+                                    uint16_t *decisions))
+{
+	int i, lane, depth, state, offset;
+	int16_t (*cur)[VITERBI_BATCH_LANES], (*next)[VITERBI_BATCH_LANES], (*tmp)[VITERBI_BATCH_LANES];
+	int16_t best_metric[VITERBI_BATCH_LANES];
+	uint8_t best_state[VITERBI_BATCH_LANES];
+	int total_metric[VITERBI_BATCH_LANES];
+	uint8_t coding[NUM_STATES/2];
+
+	/* Encoder output for each pair of next states, given in=0 */
+	for (state=0; state<NUM_STATES/2; state+=2) {
+		coding[state] = parity(state & G1) << 1 | parity(state & G2);
+	}
+
+	/* Start from the same state as a freshly initialized decoder */
+	cur = batch->metrics[0];
+	next = batch->metrics[1];
+	memset(cur, 0, sizeof(batch->metrics[0]));
+	memset(batch->decisions, 0, sizeof(batch->decisions));
+	memset(total_metric, 0, sizeof(total_metric));
+	depth = 0;
+
+	for (offset=0; offset < bytecount; offset += MEM_BACKTRACE >> 3) {
+		/* Transpose the soft symbols so that each step reads one vector. Unused
+		 * lanes decode zeroes, and their output is discarded */
+		memset(batch->x, 0, sizeof(batch->x));
+		memset(batch->y, 0, sizeof(batch->y));
+		for (lane=0; lane<lanes; lane++) {
+			for (i=0; i<MEM_BACKTRACE; i++) {
+				batch->y[i][lane] = -in[lane][2*(8*offset + i)];
+				batch->x[i][lane] = -in[lane][2*(8*offset + i) + 1];
+			}
+		}
+
+		/* Viterbi forward step */
+		for (i=0; i<MEM_BACKTRACE; i++) {
+			depth = NEXT_DEPTH(depth);
+			update_metrics(batch->x[i], batch->y[i], coding, cur, next, batch->decisions[depth]);
+
+			tmp = cur;
+			cur = next;
+			next = tmp;
+		}
+
+		/* Find the state with the best metric in each lane */
+		for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+			best_metric[lane] = cur[0][lane];
+			best_state[lane] = 0;
+		}
+		for (state=1; state<NUM_STATES; state++) {
+			for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+				if (BETTER_METRIC(cur[state][lane], best_metric[lane])) {
+					best_metric[lane] = cur[state][lane];
+					best_state[lane] = state;
+				}
+			}
+		}
+
+		/* Resize metrics to prevent overflows */
+		for (state=0; state<NUM_STATES; state++) {
+			for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+				cur[state][lane] -= best_metric[lane];
+			}
+		}
+
+		/* Update total metrics */
+		for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+			total_metric[lane] += 2 * ((127 * MEM_BACKTRACE) - best_metric[lane]);
+		}
+
+		/* Backtrace each lane from its best state and write bits */
+		backtrace_batch(batch, out, lanes, best_state, depth, offset);
+	}
+
+	if (metrics) {
+		for (lane=0; lane<lanes; lane++) {
+			metrics[lane] = total_metric[lane];
+		}
+	}
+}
+
+__attribute__((always_inline))
+static inline void
+update_metrics_batch_generic(const int8_t *x, const int8_t *y, const uint8_t *coding,
+                             int16_t (*metrics)[VITERBI_BATCH_LANES], int16_t (*next_metrics)[VITERBI_BATCH_LANES],
+                             uint16_t *decisions)
+{
+	int lane;
+	uint8_t state;
+	int16_t local_metrics[4][VITERBI_BATCH_LANES];
+	int16_t metric0, metric1, metric2, metric3, best01, best23;
+	int16_t lm0, lm1, lm2, lm3;
+	uint16_t prev01, prev23;
+	uint8_t ns0, ns1, ns2, ns3;
+
+	for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+		local_metrics[0][lane] = metric(x[lane], y[lane], 0);
+		local_metrics[1][lane] = metric(x[lane], y[lane], 1);
+		local_metrics[2][lane] = metric(x[lane], y[lane], 2);
+		local_metrics[3][lane] = metric(x[lane], y[lane], 3);
+	}
+
+	for (state=0; state<NUM_STATES/2; state+=2) {
+		ns0 = state;
+		ns1 = state + (1 << (K-1));
+		ns2 = ns0 + 1;
+		ns3 = ns1 + 1;
+
+		/* Same as update_metrics_generic(), one bit per lane */
+		prev01 = prev23 = 0;
+		for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+			metric0 = metrics[state<<1][lane];
+			metric1 = metrics[(state<<1)+1][lane];
+			metric2 = metrics[(state<<1)+2][lane];
+			metric3 = metrics[(state<<1)+3][lane];
+
+			best01 = BETTER_METRIC(metric0, metric1) ? metric0 : metric1;
+			best23 = BETTER_METRIC(metric2, metric3) ? metric2 : metric3;
+			prev01 |= !BETTER_METRIC(metric0, metric1) << lane;
+			prev23 |= !BETTER_METRIC(metric2, metric3) << lane;
+
+			lm0 = local_metrics[coding[state]][lane];
+			lm1 = TWIN_METRIC(lm0, x[lane], y[lane]);
+			lm2 = lm1;
+			lm3 = TWIN_METRIC(lm2, x[lane], y[lane]);
+
+			next_metrics[ns0][lane] = best01 + lm0;
+			next_metrics[ns1][lane] = best01 + lm1;
+			next_metrics[ns2][lane] = best23 + lm2;
+			next_metrics[ns3][lane] = best23 + lm3;
+		}
+		decisions[ns0] = prev01;
+		decisions[ns2] = prev23;
+	}
+}
+
+static int
+decode_batch_sequential(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount)
+{
+	ViterbiDecoder *vit;
+	int lane, metric;
+
+	(void)batch;
+	if (!(vit = viterbi_decoder_init())) return 1;
+
+	for (lane=0; lane<lanes; lane++) {
+		reset(vit);
+		metric = viterbi_decoder_decode(vit, out[lane], in[lane], bytecount);
+		if (metrics) metrics[lane] = metric;
+	}
+
+	viterbi_decoder_free(vit);
+	return 0;
+}
+
+static int
+decode_batch_generic(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount)
+{
+	decode_batch(batch, out, in, metrics, lanes, bytecount, update_metrics_batch_generic);
+	return 0;
+}
+
+#if defined(ARCH_X86) && (POLY_TOP_BITS == 0x3 || POLY_TOP_BITS == 0x0)
+__attribute__((always_inline)) TARGET_AVX2
+static inline void
+update_metrics_batch_avx2(const int8_t *x, const int8_t *y, const uint8_t *coding,
+                          int16_t (*metrics)[VITERBI_BATCH_LANES], int16_t (*next_metrics)[VITERBI_BATCH_LANES],
+                          uint16_t *decisions)
+{
+	uint8_t state;
+	__m256i x_vec, y_vec, local_metrics[4];
+	__m256i metric0, metric1, metric2, metric3, best01, best23;
+	__m256i take_even, lm0, lm1;
+	uint32_t prev;
+	int i;
+
+	/* Compute the local metrics of all the lanes, like metric() does */
+	x_vec = _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i*)x));
+	y_vec = _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i*)y));
+	local_metrics[0] = _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_add_epi16(x_vec, y_vec));
+	local_metrics[1] = _mm256_sub_epi16(y_vec, x_vec);
+	local_metrics[2] = _mm256_sub_epi16(x_vec, y_vec);
+	local_metrics[3] = _mm256_add_epi16(x_vec, y_vec);
+	for (i=0; i<4; i++) {
+		local_metrics[i] = _mm256_srai_epi16(local_metrics[i], 1);
+		local_metrics[i] = _mm256_max_epi16(_mm256_set1_epi16(-128), _mm256_min_epi16(_mm256_set1_epi16(127), local_metrics[i]));
+	}
+
+	for (state=0; state<NUM_STATES/2; state+=2) {
+		/* Each vector holds the metrics of the same state for all the lanes,
+		 * so no shuffling is required */
+		metric0 = _mm256_load_si256((__m256i*)metrics[state<<1]);
+		metric1 = _mm256_load_si256((__m256i*)metrics[(state<<1)+1]);
+		metric2 = _mm256_load_si256((__m256i*)metrics[(state<<1)+2]);
+		metric3 = _mm256_load_si256((__m256i*)metrics[(state<<1)+3]);
+
+		best01 = _mm256_max_epi16(metric0, metric1);
+		best23 = _mm256_max_epi16(metric2, metric3);
+
+		/* Pack the masks of ns0 and ns2 into bytes, undo the lane interleaving,
+		 * and save one bit per lane: 1 if the odd predecessor was better */
+		take_even = _mm256_packs_epi16(_mm256_cmpgt_epi16(metric0, metric1),
+		                               _mm256_cmpgt_epi16(metric2, metric3));
+		take_even = _mm256_permute4x64_epi64(take_even, 0xD8);
+		prev = ~_mm256_movemask_epi8(take_even);
+		decisions[state] = prev;
+		decisions[state+1] = prev >> 16;
+
+		/* lm2 = lm1 and lm3 = lm0, see update_metrics_generic() */
+		lm0 = local_metrics[coding[state]];
+		lm1 = POLY_TOP_BITS == 0x00 ? lm0 : _mm256_sub_epi16(_mm256_setzero_si256(), lm0);
+
+		_mm256_store_si256((__m256i*)next_metrics[state], _mm256_add_epi16(best01, lm0));
+		_mm256_store_si256((__m256i*)next_metrics[state + (1<<(K-1))], _mm256_add_epi16(best01, lm1));
+		_mm256_store_si256((__m256i*)next_metrics[state+1], _mm256_add_epi16(best23, lm1));
+		_mm256_store_si256((__m256i*)next_metrics[state+1 + (1<<(K-1))], _mm256_add_epi16(best23, lm0));
+	}
+}
+
+TARGET_AVX2 static int
+decode_batch_avx2(ViterbiBatch *batch, uint8_t *const *out, int8_t *const *in, int *metrics, int lanes, int bytecount)
+{
+	decode_batch(batch, out, in, metrics, lanes, bytecount, update_metrics_batch_avx2);
+	return 0;
+}
+#endif
+
+static void*
+decode_segment(void *arg)
+{
+	Segment *seg = (Segment*)arg;
+	uint8_t scratch[CHUNK_BYTES];
+	long chunk;
+
+	seg->metric = 0;
+
+	/* Warm up, discarding the output */
+	for (chunk = seg->from; chunk < seg->start - 1; chunk++) {
+		viterbi_decoder_decode(seg->vit, scratch, seg->in + chunk * CHUNK_SYMBOLS, CHUNK_BYTES);
+	}
+	copy_decoder(seg->head, seg->vit);
+	if (seg->start > 0) {
+		viterbi_decoder_decode(seg->vit, scratch, seg->in + chunk * CHUNK_SYMBOLS, CHUNK_BYTES);
+	}
+
+	/* Decode the segment, saving the state right before the last chunk so that
+	 * the next segment can be checked against it */
+	for (chunk = seg->start; chunk < seg->end; chunk++) {
+		if (chunk == seg->end - 1) copy_decoder(seg->tail, seg->vit);
+		seg->metric += viterbi_decoder_decode(seg->vit, seg->out + chunk * CHUNK_BYTES,
+		                                      seg->in + chunk * CHUNK_SYMBOLS, CHUNK_BYTES);
+	}
+
+	return NULL;
+}
+
+static void
+copy_decoder(ViterbiDecoder *dst, const ViterbiDecoder *src)
+{
+	memcpy(dst, src, sizeof(*dst));
+
+	/* Rebind metric arrays to the destination struct */
+	dst->metrics = src->metrics == src->raw_metrics ? dst->raw_metrics : dst->raw_next_metrics;
+	dst->next_metrics = src->metrics == src->raw_metrics ? dst->raw_next_metrics : dst->raw_metrics;
+	dst->metrics8 = src->metrics8 == src->raw_metrics8 ? dst->raw_metrics8 : dst->raw_next_metrics8;
+	dst->next_metrics8 = src->metrics8 == src->raw_metrics8 ? dst->raw_next_metrics8 : dst->raw_metrics8;
+}
+
+static inline void
+swap_metrics(ViterbiDecoder *vit)
+{
+	int16_t *const tmp = vit->metrics;
+
+	/* Swap metric and next_metrics for the next iteration */
+	vit->metrics = vit->next_metrics;
+	vit->next_metrics = tmp;
+}
+
+static inline void
+swap_metrics8(ViterbiDecoder *vit)
+{
+	int8_t *const tmp = vit->metrics8;
+
+	vit->metrics8 = vit->next_metrics8;
+	vit->next_metrics8 = tmp;
+}
+
+static int
+forward(ViterbiDecoder *vit, const int8_t *in, uint8_t *best_state)
+{
+	int i;
+	int best_metric;
+	uint8_t state;
+	int8_t x, y, x1, y1;
+	void (*const update_metrics)(ViterbiDecoder *vit, int8_t x, int8_t y) = vit->int8 ? _update_metrics8 : _update_metrics;
+
+	/* Viterbi forward step */
+	if (!vit->int8 && _update_metrics2) {
+		/* Two steps at a time. The kernel fills in the decisions of both the
+		 * current depth and the next one */
+		for (i=MEM_START; i<(int)MEM_DEPTH; i+=2) {
+			vit->depth = NEXT_DEPTH(vit->depth);
+
+			y = *in++;
+			x = *in++;
+			y1 = *in++;
+			x1 = *in++;
+
+			_update_metrics2(vit, -x, -y, -x1, -y1);
+			vit->depth = NEXT_DEPTH(vit->depth);
+		}
+	} else {
+		for (i=MEM_START; i<(int)MEM_DEPTH; i++) {
+			vit->depth = NEXT_DEPTH(vit->depth);
+
+			y = *in++;
+			x = *in++;
+
+			update_metrics(vit, -x, -y);
+		}
+	}
+
+	if (vit->int8) {
+		/* 8-bit metrics are renormalized at every step, so that the best
+		 * one is always 0: the growth of the best metric is the sum of the
+		 * offsets removed from it, scaled back to the 16-bit range */
+		for (state=0; vit->metrics8[state]; state++);
+		best_metric = vit->norm << METRIC8_SHIFT;
+		vit->norm = 0;
+	} else {
+		/* Find the state with the best metric */
+		state = 0;
+		best_metric = vit->metrics[0];
+		for (i=1; i<NUM_STATES; i++) {
+			if (BETTER_METRIC(vit->metrics[i], best_metric)) {
+				best_metric = vit->metrics[i];
+				state = i;
+			}
+		}
+
+		/* Resize metrics to prevent overflows */
+		for (i=0; i<NUM_STATES; i++) {
+			vit->metrics[i] -= best_metric;
+		}
+	}
+
+	*best_state = state;
+	return 2 * ((127 * MEM_BACKTRACE) - best_metric);
+}
+
+static void
+save_decisions(const ViterbiDecoder *vit, uint64_t *dst, int count)
+{
+	int depth = vit->depth;
+
+	/* Copy the last count decisions, oldest first */
+	for (count--; count >= 0; count--) {
+		dst[count] = vit->decisions[depth];
+		depth = PREV_DEPTH(depth);
+	}
+}
+
+static void
+backtrace(ViterbiDecoder *vit, uint8_t *out, uint8_t state, int bitskip, int bitcount)
+{
+	int i, bytecount;
+	int depth = vit->depth;
+	uint8_t tmp;
+
+	assert(!(bitcount & 0x7));
+
+	/* Backtrace without writing bits */
+	for (; bitskip > 0; bitskip--) {
+		state = PREV_STATE(state, vit->decisions[depth]);
+		depth = PREV_DEPTH(depth);
+	}
+
+	/* Preemptively advance out: bits are written in reverse order */
+	bytecount = bitcount >> 3;
+	out += bytecount;
+
+	/* Backtrace while writing bits */
+	for (;bytecount > 0; bytecount--) {
+		tmp = 0;
+		/* Process each byte separately */
+		for (i=0; i<8; i++) {
+			tmp |= (state >> (K-1)) << i;
+			state = PREV_STATE(state, vit->decisions[depth]);
+			depth = PREV_DEPTH(depth);
+		}
+
+		/* Copy byte to output, then go to the previous byte */
+		*--out = tmp;
+	}
+}
+
+static void
+backtrace_block(const ViterbiDecoder *vit, uint8_t *out, uint8_t state, int bitskip, int bitcount)
+{
+	int i, bytecount;
+	const uint64_t *decisions = vit->block + vit->block_len;
+	uint8_t tmp;
+
+	assert(!(bitcount & 0x7));
+
+	/* Same as backtrace(), walking the linear block memory instead of the
+	 * circular one */
+	for (; bitskip > 0; bitskip--) {
+		state = PREV_STATE(state, *--decisions);
+	}
+
+	bytecount = bitcount >> 3;
+	out += bytecount;
+
+	for (;bytecount > 0; bytecount--) {
+		tmp = 0;
+		for (i=0; i<8; i++) {
+			tmp |= (state >> (K-1)) << i;
+			state = PREV_STATE(state, *--decisions);
+		}
+
+		*--out = tmp;
+	}
+}
+
+static void
+backtrace_batch(const ViterbiBatch *batch, uint8_t *const *out, int lanes, const uint8_t *best_state, int depth, int offset)
+{
+	int i, lane, bytecount;
+	uint8_t state[VITERBI_BATCH_LANES];
+	uint8_t tmp[VITERBI_BATCH_LANES];
+
+	/* Same as backtrace(), reading the decisions of each lane. All the lanes
+	 * are traced back together, so that their (independent) dependency chains
+	 * can overlap */
+	memcpy(state, best_state, sizeof(state));
+	for (i=0; i<MEM_START; i++) {
+		for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+			state[lane] = PREV_STATE_LANE(state[lane], batch->decisions[depth], lane);
+		}
+		depth = PREV_DEPTH(depth);
+	}
+
+	for (bytecount = MEM_BACKTRACE >> 3; bytecount > 0; bytecount--) {
+		memset(tmp, 0, sizeof(tmp));
+		for (i=0; i<8; i++) {
+			for (lane=0; lane<VITERBI_BATCH_LANES; lane++) {
+				tmp[lane] |= (state[lane] >> (K-1)) << i;
+				state[lane] = PREV_STATE_LANE(state[lane], batch->decisions[depth], lane);
+			}
+			depth = PREV_DEPTH(depth);
+		}
+
+		for (lane=0; lane<lanes; lane++) {
+			out[lane][offset + bytecount-1] = tmp[lane];
+		}
 	}
 }
 
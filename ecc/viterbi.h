@@ -14,6 +14,12 @@
 #define MEM_BACKTRACE (MEM_DEPTH-MEM_START) /* Complementary of MEM_START */
 #define VITERBI_DELAY (MEM_START/8)         /* Internal buffer size, in bytes */
 
+#define VITERBI_BATCH_LANES 16              /* Segments decoded together by viterbi_decode_batch() */
+#define VITERBI_WARMUP (16*MEM_BACKTRACE)   /* Bits decoded before a segment in viterbi_decode_parallel() */
+#define VITERBI_BLOCK (8*sizeof(Cadu))      /* Maximum bits decoded by a single traceback in block mode */
+
+typedef struct _viterbi ViterbiDecoder;
+
 #if (MEM_START % 8)
 #error "MEM_START should be a multiple of 8"
 #endif
@@ -36,7 +42,7 @@
 uint32_t conv_encode_u32(uint64_t *output, uint32_t state, uint32_t data);
 
 /**
- * Initialize the Viterbi decoder
+ * Initialize the default Viterbi decoder, used by viterbi_decode()
  */
 void     viterbi_init();
 
@@ -52,4 +58,162 @@ void     viterbi_init();
  */
 int     viterbi_decode(uint8_t *out, int8_t *in, int bytecount);
 
+/**
+ * Allocate and initialize an independent Viterbi decoder. Different decoders
+ * can be used concurrently from different threads, as long as the first call
+ * to this function (or to viterbi_init()) is not done concurrently.
+ *
+ * @return pointer to the decoder, or NULL on failure
+ */
+ViterbiDecoder *viterbi_decoder_init();
+
+/**
+ * Decode soft symbols into bits using the given Viterbi decoder
+ *
+ * @param vit decoder to use
+ * @param out pointer to the memory region where the decoded bytes should be
+ *        written to
+ * @param in pointer to the soft symbols to feed to the decoder
+ * @param bytecount number of bytes to write to the output. Must be 1/16th the
+ *        number of valid soft symbols supplied to the decoder.
+ * @return the total metric of the best path
+ */
+int     viterbi_decoder_decode(ViterbiDecoder *vit, uint8_t *out, int8_t *in, int bytecount);
+
+/**
+ * Run the forward pass of the Viterbi algorithm on soft symbols, without
+ * tracing back the best path: the decisions are kept in memory until the next
+ * call to viterbi_decoder_decode_block(). At most VITERBI_BLOCK bits can be
+ * accumulated between two tracebacks. Do not mix with viterbi_decoder_decode()
+ * on the same decoder without resetting it first.
+ *
+ * @param vit decoder to use
+ * @param in pointer to the soft symbols to feed to the decoder
+ * @param bytecount number of bytes worth of soft symbols to process
+ * @return the total metric of the best path
+ */
+int     viterbi_decoder_advance(ViterbiDecoder *vit, int8_t *in, int bytecount);
+
+/**
+ * Same as viterbi_decoder_advance(), followed by a single traceback covering
+ * all the bits processed since the previous one. Compared to
+ * viterbi_decoder_decode(), which traces back MEM_DEPTH bits for every
+ * MEM_BACKTRACE bits written, this roughly halves the time spent tracing back
+ * when decoding a whole CADU at once.
+ *
+ * The output is VITERBI_DELAY bytes late with respect to the input, so the
+ * number of bytes written is the number of bytes processed since the previous
+ * traceback, minus VITERBI_DELAY if this is the first one since the decoder
+ * was initialized.
+ *
+ * @param vit decoder to use
+ * @param out pointer to the memory region where the decoded bytes should be
+ *        written to
+ * @param in pointer to the soft symbols to feed to the decoder
+ * @param bytecount number of bytes worth of soft symbols to process
+ * @return the total metric of the best path
+ */
+int     viterbi_decoder_decode_block(ViterbiDecoder *vit, uint8_t *out, int8_t *in, int bytecount);
+
+/**
+ * Same as viterbi_decoder_advance(), applied to the default decoder
+ */
+int     viterbi_advance(int8_t *in, int bytecount);
+
+/**
+ * Same as viterbi_decoder_decode_block(), applied to the default decoder
+ */
+int     viterbi_decode_block(uint8_t *out, int8_t *in, int bytecount);
+
+/**
+ * Free a decoder allocated via viterbi_decoder_init()
+ *
+ * @param vit decoder to free
+ */
+void    viterbi_decoder_free(ViterbiDecoder *vit);
+
+/**
+ * Decode several independent segments of soft symbols at once. Segments are
+ * processed in groups of VITERBI_BATCH_LANES, with the metrics of the same
+ * state in different segments stored next to each other, so that a single
+ * add-compare-select operation updates all the segments in a group. Each
+ * segment is decoded exactly like a freshly initialized decoder would.
+ *
+ * @param out array of pointers to the memory regions where the decoded bytes
+ *        of each segment should be written to
+ * @param in array of pointers to the soft symbols of each segment
+ * @param metrics array where the total metric of the best path of each segment
+ *        should be written to. Can be NULL
+ * @param count number of segments
+ * @param bytecount number of bytes to write to the output of each segment.
+ *        Must be 1/16th the number of soft symbols in each segment.
+ * @return 0 on success
+ *         anything else on failure
+ */
+int     viterbi_decode_batch(uint8_t *const *out, int8_t *const *in, int *metrics, int count, int bytecount);
+
+/**
+ * Switch a decoder to 8-bit saturating path metrics, or back to 16-bit ones.
+ * 8-bit metrics allow twice as many states to be processed per instruction,
+ * at the cost of coarser local metrics. Resets the decoder's state.
+ *
+ * @param vit decoder to configure
+ * @param enable 1 to use 8-bit metrics, 0 to use 16-bit metrics
+ * @return 0 on success
+ *         anything else if 8-bit metrics are unsupported for G1/G2
+ */
+int     viterbi_decoder_set_int8(ViterbiDecoder *vit, int enable);
+
+/**
+ * Same as viterbi_decoder_set_int8(), applied to the default decoder. Must be
+ * called after viterbi_init().
+ *
+ * @param enable 1 to use 8-bit metrics, 0 to use 16-bit metrics
+ * @return 0 on success
+ *         anything else if 8-bit metrics are unsupported for G1/G2
+ */
+int     viterbi_set_int8(int enable);
+
+/**
+ * Decode a long buffer of soft symbols using multiple threads. The buffer is
+ * split into one segment per thread, and each segment is decoded starting
+ * VITERBI_WARMUP bits earlier, so that its path metrics can converge to the
+ * ones a sequential decoder would have. Once all threads are done, the
+ * metrics of each segment at the beginning of its output are compared with
+ * the ones of the previous segment at the same point, and any segment whose
+ * metrics did not converge is decoded again, starting from the exact state of
+ * the previous one. The output is therefore identical to the one of a freshly
+ * initialized decoder fed the whole buffer.
+ *
+ * @param out pointer to the memory region where the decoded bytes should be
+ *        written to
+ * @param in pointer to the soft symbols to feed to the decoder
+ * @param bytecount number of bytes to write to the output. Must be 1/16th the
+ *        number of valid soft symbols supplied to the decoder.
+ * @param threads maximum number of threads to use
+ * @param metric pointer to where the total metric of the best path should be
+ *        written to. Can be NULL
+ * @return 0 on success
+ *         anything else on failure
+ */
+int     viterbi_decode_parallel(uint8_t *out, int8_t *in, long bytecount, int threads, long *metric);
+
+/**
+ * Get the name of the add-compare-select kernel selected by viterbi_init()
+ * for the default decoder, taking into account whether it uses 8-bit metrics
+ *
+ * @return a string describing the kernel
+ */
+const char *viterbi_kernel_name();
+
+/**
+ * Allow or prevent the selection of the radix-4 kernels, which process two
+ * trellis steps at once. Radix-4 kernels are not used by default, as they are
+ * not measurably faster than the radix-2 ones: this is mostly useful to
+ * compare them. Must be called before viterbi_init().
+ *
+ * @param enable 1 to allow radix-4 kernels, 0 to only use radix-2 ones
+ */
+void    viterbi_set_radix4(int enable);
+
 #endif /* viterbi_h */
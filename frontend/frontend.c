@@ -0,0 +1,360 @@
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+#include "frontend.h"
+#include "math/int.h"
+#include "utils.h"
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
+
+static void select_kernel();
+static inline int8_t signsqrt(int x);
+static void frontend_generic(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded);
+#ifdef ARCH_X86
+__attribute__((always_inline)) TARGET_AVX2 static inline __m256i sqrt_lookup_avx2(__m256i products);
+TARGET_SSSE3 static void frontend_ssse3(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded);
+TARGET_AVX2 static void frontend_avx2(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded);
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static void frontend_neon(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded);
+#endif
+
+/* Undoing a rotation, expressed as an optional I/Q swap followed by a sign
+ * change on each sample of the pair (same as in soft_derotate()) */
+static const struct {
+	int swap;
+	int8_t sign[2];
+} _derotations[] = {
+	{0, { 1,  1}},     /* PHASE_0:       (x, y) -> (x, y) */
+	{1, { 1, -1}},     /* PHASE_90:      (x, y) -> (y, -x) */
+	{0, {-1, -1}},     /* PHASE_180:     (x, y) -> (-x, -y) */
+	{1, {-1,  1}},     /* PHASE_270:     (x, y) -> (-y, x) */
+	{1, { 1,  1}},     /* PHASE_INV_0:   (x, y) -> (y, x) */
+	{0, {-1,  1}},     /* PHASE_INV_90:  (x, y) -> (-x, y) */
+	{1, {-1, -1}},     /* PHASE_INV_180: (x, y) -> (-y, -x) */
+	{0, { 1, -1}},     /* PHASE_INV_270: (x, y) -> (x, -y) */
+};
+
+/* Last pair of samples, before differential decoding */
+static int _prev_i, _prev_q;
+
+/* int_sqrt() of the products of two samples. The padding lets the AVX2 kernel
+ * read 32 bits starting from any entry */
+static uint8_t _sqrt_table[128*128 + 4];
+
+/* Kernel, selected on first use based on the CPU features */
+static void (*_frontend)(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded);
+static const char *_kernel_name;
+
+void
+frontend_init()
+{
+	int x;
+
+	_prev_i = 0;
+	_prev_q = 0;
+
+	for (x=0; x<=128*128; x++) {
+		_sqrt_table[x] = int_sqrt(x);
+	}
+}
+
+void
+frontend_process(uint8_t *hard, int8_t *soft, int len, enum phase phase, int diffcoded)
+{
+	if (!_frontend) select_kernel();
+	_frontend(hard, soft, len, phase, diffcoded);
+}
+
+const char*
+frontend_kernel_name()
+{
+	if (!_frontend) select_kernel();
+	return _kernel_name;
+}
+
+/* Static functions {{{ */
+static void
+select_kernel()
+{
+	_frontend = frontend_generic;
+	_kernel_name = "generic";
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	_frontend = frontend_neon;
+	_kernel_name = "neon";
+#endif
+#ifdef ARCH_X86
+	if (cpu_features() & CPU_SSSE3) {
+		_frontend = frontend_ssse3;
+		_kernel_name = "ssse3";
+	}
+	if (cpu_features() & CPU_AVX2) {
+		_frontend = frontend_avx2;
+		_kernel_name = "avx2";
+	}
+#endif
+}
+
+/* Same as the original differential decoder: the square root of 128*128 does
+ * not fit in an int8_t, and wraps to -128 before clamping */
+static inline int8_t
+signsqrt(int x)
+{
+	return (x > 0) ? _sqrt_table[x] : -_sqrt_table[-x];
+}
+
+static void
+frontend_generic(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded)
+{
+	const int swap = _derotations[phase].swap;
+	const int sign_x = _derotations[phase].sign[0];
+	const int sign_y = _derotations[phase].sign[1];
+	int i, x, y, tmp;
+
+	for (i=0; i<len; i+=2) {
+		x = soft[i];
+		y = soft[i+1];
+
+		if (diffcoded) {
+			tmp = x;
+			x = signsqrt(x * _prev_q);
+			_prev_q = tmp;
+
+			tmp = y;
+			y = signsqrt(-y * _prev_i);
+			_prev_i = tmp;
+		}
+
+		/* Prevent overflows when changing sign */
+		x = MAX(-127, x);
+		y = MAX(-127, y);
+
+		if (swap) {
+			tmp = x;
+			x = y;
+			y = tmp;
+		}
+
+		soft[i] = sign_x * x;
+		soft[i+1] = sign_y * y;
+
+		/* Four pairs per byte, the bits shifted in first end up in the MSBs */
+		if (hard) {
+			hard[i/8] = hard[i/8] << 2 | (soft[i] < 0) << 1 | (soft[i+1] < 0);
+		}
+	}
+}
+
+#ifdef ARCH_X86
+/* The differential decoder multiplies each sample by the one in the previous
+ * pair, and takes the square root of the result keeping its sign (flipped for
+ * the second sample of the pair). The products fit in 16 bits, and their
+ * square roots are looked up in the same table as the generic kernel, so that
+ * every kernel gives the same output as int_sqrt().
+ * The result is clamped, the rotation is then undone with the same shuffle and
+ * sign change as in soft_derotate_avx2(), and the hard samples are the sign
+ * bits of the result */
+TARGET_SSSE3 static void
+frontend_ssse3(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded)
+{
+	const __m128i swap_iq = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m128i reverse = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	const __m128i sign = _mm_set1_epi16((uint8_t)_derotations[phase].sign[0] | (uint8_t)_derotations[phase].sign[1] << 8);
+	const __m128i odd = _mm_set1_epi16(0x8000);
+	const __m128i overflow = _mm_set1_epi8(-128);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i zero = _mm_setzero_si128();
+	uint16_t products[16] __attribute__((aligned(16)));
+	uint8_t roots[16] __attribute__((aligned(16)));
+	__m128i vec, prev, delayed;
+	uint16_t bits;
+	int i;
+
+	prev = _mm_insert_epi16(zero, (uint8_t)_prev_q | (uint8_t)_prev_i << 8, 7);
+
+	for (; len >= 16; len -= 16) {
+		vec = _mm_loadu_si128((__m128i*)soft);
+
+		if (diffcoded) {
+			delayed = _mm_alignr_epi8(vec, prev, 14);
+			prev = vec;
+
+			/* No gather instruction: look the square roots up one by one */
+			_mm_store_si128((__m128i*)products, _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_abs_epi8(vec), zero), _mm_unpacklo_epi8(_mm_abs_epi8(delayed), zero)));
+			_mm_store_si128((__m128i*)(products + 8), _mm_mullo_epi16(_mm_unpackhi_epi8(_mm_abs_epi8(vec), zero), _mm_unpackhi_epi8(_mm_abs_epi8(delayed), zero)));
+			for (i=0; i<16; i++) {
+				roots[i] = _sqrt_table[products[i]];
+			}
+
+			vec = _mm_sign_epi8(_mm_load_si128((__m128i*)roots),
+			                    _mm_or_si128(_mm_xor_si128(_mm_xor_si128(vec, delayed), odd), one));
+		}
+
+		/* Prevent overflows when changing sign */
+		vec = _mm_sub_epi8(vec, _mm_cmpeq_epi8(vec, overflow));
+
+		if (_derotations[phase].swap) vec = _mm_shuffle_epi8(vec, swap_iq);
+		vec = _mm_sign_epi8(vec, sign);
+		_mm_storeu_si128((__m128i*)soft, vec);
+
+		if (hard) {
+			bits = _mm_movemask_epi8(_mm_shuffle_epi8(vec, reverse));
+			memcpy(hard, &bits, sizeof(bits));
+			hard += 2;
+		}
+
+		soft += 16;
+	}
+
+	if (diffcoded) {
+		_prev_q = (int8_t)(_mm_extract_epi16(prev, 7) & 0xFF);
+		_prev_i = (int8_t)(_mm_extract_epi16(prev, 7) >> 8);
+	}
+
+	frontend_generic(hard, soft, len, phase, diffcoded);
+}
+
+TARGET_AVX2 static void
+frontend_avx2(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded)
+{
+	const __m256i swap_iq = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+	                                         1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+	                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	const __m256i sign = _mm256_set1_epi16((uint8_t)_derotations[phase].sign[0] | (uint8_t)_derotations[phase].sign[1] << 8);
+	const __m256i odd = _mm256_set1_epi16(0x8000);
+	const __m256i min_val = _mm256_set1_epi8(-127);
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i vec, prev, delayed, lo, hi;
+	uint32_t bits;
+
+	prev = _mm256_insert_epi16(zero, (uint8_t)_prev_q | (uint8_t)_prev_i << 8, 15);
+
+	for (; len >= 32; len -= 32) {
+		vec = _mm256_loadu_si256((__m256i*)soft);
+
+		if (diffcoded) {
+			/* Samples from the previous pair: the last two of the previous
+			 * vector, followed by all but the last two of this one */
+			delayed = _mm256_alignr_epi8(vec, _mm256_permute2x128_si256(prev, vec, 0x21), 14);
+			prev = vec;
+
+			/* Unpacking and packing back within each lane keeps the samples in
+			 * order */
+			lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(_mm256_abs_epi8(vec), zero), _mm256_unpacklo_epi8(_mm256_abs_epi8(delayed), zero));
+			hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(_mm256_abs_epi8(vec), zero), _mm256_unpackhi_epi8(_mm256_abs_epi8(delayed), zero));
+			lo = _mm256_packs_epi32(sqrt_lookup_avx2(_mm256_unpacklo_epi16(lo, zero)),
+			                        sqrt_lookup_avx2(_mm256_unpackhi_epi16(lo, zero)));
+			hi = _mm256_packs_epi32(sqrt_lookup_avx2(_mm256_unpacklo_epi16(hi, zero)),
+			                        sqrt_lookup_avx2(_mm256_unpackhi_epi16(hi, zero)));
+
+			vec = _mm256_sign_epi8(_mm256_packus_epi16(lo, hi),
+			                       _mm256_or_si256(_mm256_xor_si256(_mm256_xor_si256(vec, delayed), odd), one));
+		}
+
+		/* Prevent overflows when changing sign */
+		vec = _mm256_max_epi8(vec, min_val);
+
+		if (_derotations[phase].swap) vec = _mm256_shuffle_epi8(vec, swap_iq);
+		vec = _mm256_sign_epi8(vec, sign);
+		_mm256_storeu_si256((__m256i*)soft, vec);
+
+		if (hard) {
+			bits = _mm256_movemask_epi8(_mm256_shuffle_epi8(vec, reverse));
+			memcpy(hard, &bits, sizeof(bits));
+			hard += 4;
+		}
+
+		soft += 32;
+	}
+
+	if (diffcoded) {
+		_prev_q = (int8_t)(_mm256_extract_epi16(prev, 15) & 0xFF);
+		_prev_i = (int8_t)(_mm256_extract_epi16(prev, 15) >> 8);
+	}
+
+	frontend_generic(hard, soft, len, phase, diffcoded);
+}
+
+/* Look up the square roots of eight 32-bit products. Each gathered word holds
+ * the square root in its low byte, followed by the next entries */
+__attribute__((always_inline)) TARGET_AVX2
+static inline __m256i
+sqrt_lookup_avx2(__m256i products)
+{
+	return _mm256_and_si256(_mm256_i32gather_epi32((const int*)_sqrt_table, products, 1),
+	                        _mm256_set1_epi32(0xFF));
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+/* Same as the x86 kernels. The hard samples are collected by weighting the
+ * sign bits and adding them up horizontally, eight at a time */
+static void
+frontend_neon(uint8_t *restrict hard, int8_t *restrict soft, int len, enum phase phase, int diffcoded)
+{
+	const uint8x16_t weights = {128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1};
+	const int8x16_t sign = vreinterpretq_s8_u16(vdupq_n_u16((uint8_t)_derotations[phase].sign[0] | (uint8_t)_derotations[phase].sign[1] << 8));
+	const int8x16_t odd = vreinterpretq_s8_u16(vdupq_n_u16(0x8000));
+	const int8x16_t min_val = vdupq_n_s8(-127);
+	uint16_t products[16];
+	uint8_t roots[16];
+	int8x16_t vec, prev, delayed, mag;
+	uint8x16_t abs_vec, abs_delayed, bits;
+	int i;
+
+	prev = vdupq_n_s8(0);
+	prev = vsetq_lane_s8(_prev_q, prev, 14);
+	prev = vsetq_lane_s8(_prev_i, prev, 15);
+
+	for (; len >= 16; len -= 16) {
+		vec = vld1q_s8(soft);
+
+		if (diffcoded) {
+			delayed = vextq_s8(prev, vec, 14);
+			prev = vec;
+
+			abs_vec = vreinterpretq_u8_s8(vabsq_s8(vec));
+			abs_delayed = vreinterpretq_u8_s8(vabsq_s8(delayed));
+			vst1q_u16(products, vmull_u8(vget_low_u8(abs_vec), vget_low_u8(abs_delayed)));
+			vst1q_u16(products + 8, vmull_high_u8(abs_vec, abs_delayed));
+			for (i=0; i<16; i++) {
+				roots[i] = _sqrt_table[products[i]];
+			}
+			mag = vreinterpretq_s8_u8(vld1q_u8(roots));
+
+			vec = vbslq_s8(vcltzq_s8(veorq_s8(veorq_s8(vec, delayed), odd)), vnegq_s8(mag), mag);
+		}
+
+		/* Prevent overflows when changing sign */
+		vec = vmaxq_s8(vec, min_val);
+
+		if (_derotations[phase].swap) vec = vrev16q_s8(vec);
+		vec = vmulq_s8(vec, sign);
+		vst1q_s8(soft, vec);
+
+		if (hard) {
+			bits = vmulq_u8(vshrq_n_u8(vreinterpretq_u8_s8(vec), 7), weights);
+			hard[0] = vaddv_u8(vget_low_u8(bits));
+			hard[1] = vaddv_u8(vget_high_u8(bits));
+			hard += 2;
+		}
+
+		soft += 16;
+	}
+
+	if (diffcoded) {
+		_prev_q = vgetq_lane_s8(prev, 14);
+		_prev_i = vgetq_lane_s8(prev, 15);
+	}
+
+	frontend_generic(hard, soft, len, phase, diffcoded);
+}
+#endif
+/* }}} */
@@ -0,0 +1,37 @@
+#ifndef frontend_h
+#define frontend_h
+
+#include <stdint.h>
+#include "utils.h"
+
+/**
+ * Initialize the front-end, and reset the differential decoder state. Must be
+ * called before frontend_process()
+ */
+void frontend_init();
+
+/**
+ * Prepare a buffer of soft samples for the decoder, in a single pass over the
+ * samples: differentially decode them if necessary, clamp them to [-127, 127],
+ * undo a rotation, and convert them into hard samples
+ *
+ * @param hard pointer to the destination buffer for the hard samples, or NULL
+ *        if they are not needed. Must be at least len/8 bytes long
+ * @param soft pointer to the soft samples to process in-place
+ * @param len number of soft samples to process. Must be a multiple of 8 if hard
+ *        is not NULL
+ * @param phase the rotation to undo
+ * @param diffcoded whether the samples are differentially coded. The samples
+ *        are assumed to follow the ones passed to the previous call
+ */
+void frontend_process(uint8_t *hard, int8_t *soft, int len, enum phase phase, int diffcoded);
+
+/**
+ * Get the name of the kernel used by frontend_process(), selected at runtime
+ * based on the CPU features
+ *
+ * @return a string describing the kernel
+ */
+const char *frontend_kernel_name();
+
+#endif /* frontend_h */
@@ -1,4 +1,5 @@
 #include <string.h>
+#include "cpu.h"
 #include "jpeg.h"
 #include "utils.h"
 #define Q_SHIFT 14
@@ -8,8 +9,17 @@
 static void unzigzag(int16_t block[8][8]);
 static int quantization(int quality, int x, int y);
 static void dequantize(int16_t block[8][8], int quality);
-static void inverse_dct(uint8_t dst[8][8], int16_t src[8][8]);
-static int16_t qmul(int32_t x, int32_t y);
+static inline void inverse_dct(uint8_t dst[8][8], int16_t src[8][8]);
+static void inverse_dct_generic(uint8_t dst[8][8], int16_t src[8][8]);
+#ifdef ARCH_X86
+TARGET_AVX2 static void inverse_dct_avx2(uint8_t dst[8][8], int16_t src[8][8]);
+#endif
+static void select_kernel();
+static inline int16_t qmul(int32_t x, int32_t y);
+
+/* IDCT kernel, selected on first use based on the CPU features */
+static void (*_inverse_dct)(uint8_t dst[8][8], int16_t src[8][8]);
+static const char *_kernel_name;
 
 /* Quantization table, standard 50% quality JPEG */
 static const uint8_t _quant[8][8] =
@@ -59,12 +69,49 @@ jpeg_decode(uint8_t dst[8][8], int16_t src[8][8], int q)
 	q = q > 0 ? q : last_q;
 	last_q = q;
 
+	if (!_inverse_dct) select_kernel();
+
 	unzigzag(src);
 	dequantize(src, q);
-	inverse_dct(dst, src);
+	_inverse_dct(dst, src);
+}
+
+const char*
+jpeg_kernel_name()
+{
+	if (!_inverse_dct) select_kernel();
+	return _kernel_name;
 }
 
 /* Static functions {{{ */
+static void
+select_kernel()
+{
+	_inverse_dct = inverse_dct_generic;
+	_kernel_name = "generic";
+#ifdef ARCH_X86
+	if (cpu_features() & CPU_AVX2) {
+		_inverse_dct = inverse_dct_avx2;
+		_kernel_name = "avx2";
+	}
+#endif
+}
+
+static void
+inverse_dct_generic(uint8_t dst[8][8], int16_t src[8][8])
+{
+	inverse_dct(dst, src);
+}
+
+#ifdef ARCH_X86
+/* Same code as the generic version, vectorized by the compiler for AVX2 */
+TARGET_AVX2 static void
+inverse_dct_avx2(uint8_t dst[8][8], int16_t src[8][8])
+{
+	inverse_dct(dst, src);
+}
+#endif
+
 static void
 unzigzag(int16_t block[8][8])
 {
@@ -95,7 +142,8 @@ dequantize(int16_t block[8][8], int quality)
 	}
 }
 
-static void
+__attribute__((always_inline))
+static inline void
 inverse_dct(uint8_t dst[8][8], int16_t src[8][8])
 {
 	int i, j, u, v;
@@ -147,7 +195,8 @@ quantization(int quality, int x, int y)
 	return MAX(1, (((int)_quant[x][y] * compr_ratio / 50) + 1) / 2);
 }
 
-static int16_t
+__attribute__((always_inline))
+static inline int16_t
 qmul(int32_t x, int32_t y)
 {
 	const int32_t result = x * y;
@@ -11,5 +11,12 @@
  */
 void jpeg_decode(uint8_t dst[8][8], int16_t src[8][8], int q);
 
+/**
+ * Get the name of the IDCT kernel selected at runtime
+ *
+ * @return a string describing the kernel
+ */
+const char *jpeg_kernel_name();
+
 
 #endif /* jpeg_h */
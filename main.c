@@ -4,7 +4,13 @@
 #include <stdio.h>
 #include <string.h>
 #include "channel.h"
+#include "correlator/correlator.h"
+#include "cpu.h"
 #include "decode.h"
+#include "ecc/rs.h"
+#include "ecc/viterbi.h"
+#include "frontend/frontend.h"
+#include "jpeg/jpeg.h"
 #include "output/bmp_out.h"
 #include "parser/mcu_parser.h"
 #include "raw_channel.h"
@@ -19,12 +25,17 @@
 #define NUM_CHANNELS 3
 #define MAX_FNAME_LEN 256
 #define SHORTOPTS "7a:bBdhio:qstv"
+#define OPT_CPU_FEATURES 0x100
+#define OPT_INT8_VITERBI 0x101
+#define OPT_SOFT_SYNC 0x102
+#define OPT_ACQUIRE 0x103
 
 static int read_wrapper(int8_t *src, size_t len);
 static int preferred_channel(int apid);
 static int parse_apids(int *apids, char *optarg);
 static void process_mpdu(Mpdu *mpdu, Channel *ch[NUM_CHANNELS], RawChannel *apid_70, int quiet);
 static void write_stat_and_close(FILE *fd);
+static void print_cpu_features();
 static void sigint_handler(int val);
 
 static FILE *_soft_file;
@@ -33,14 +44,18 @@ static volatile int _running;
 
 static struct option longopts[] = {
 	{ "70",      0, NULL, '7' },
+	{ "acquire", 1, NULL, OPT_ACQUIRE },
 	{ "apid",    1, NULL, 'a' },
 	{ "batch",   0, NULL, 'B' },
 	{ "batch-alt",0,NULL, 'b' },
+	{ "cpu-features",0,NULL, OPT_CPU_FEATURES },
 	{ "diff",    0, NULL, 'd' },
 	{ "help",    0, NULL, 'h' },
 	{ "int",     0, NULL, 'i' },
+	{ "int8-viterbi",0,NULL, OPT_INT8_VITERBI },
 	{ "output",  1, NULL, 'o' },
 	{ "quiet",   0, NULL, 'q' },
+	{ "soft-sync",0, NULL, OPT_SOFT_SYNC },
 	{ "split",   0, NULL, 's' },
 	{ "statfile",0, NULL, 't' },
 	{ "version", 0, NULL, 'v' },
@@ -80,6 +95,9 @@ main(int argc, char *argv[])
 	int write_stat = 0;
 	int write_apid_70 = 0;
 	int quiet = 0;
+	int int8_viterbi = 0;
+	int soft_sync = 0;
+	int acquire_cadus = 1;
 	/* }}} */
 	/* Parse command-line options {{{ */
 	optind = 0;
@@ -123,6 +141,24 @@ main(int argc, char *argv[])
 			case 't':
 				write_stat = 1;
 				break;
+			case OPT_INT8_VITERBI:
+				int8_viterbi = 1;
+				break;
+			case OPT_SOFT_SYNC:
+				soft_sync = 1;
+				break;
+			case OPT_ACQUIRE:
+				acquire_cadus = atoi(optarg);
+				if (acquire_cadus < 1) {
+					fprintf(stderr, "Invalid number of CADUs to accumulate specified\n");
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case OPT_CPU_FEATURES:
+				decode_init(0, 0);
+				print_cpu_features();
+				return 0;
 			default:
 				usage(argv[0]);
 				return 1;
@@ -213,6 +249,13 @@ main(int argc, char *argv[])
 
 	/* Initialize decoder */
 	decode_init(diffcoded, interleaved);
+	decode_set_soft_sync(soft_sync);
+	if (decode_set_sync_acquisition(acquire_cadus)) {
+		fprintf(stderr, "Could not allocate the syncword accumulator, using single-CADU acquisition\n");
+	}
+	if (int8_viterbi && viterbi_set_int8(1)) {
+		fprintf(stderr, "8-bit Viterbi metrics are not supported, using 16-bit metrics\n");
+	}
 	/* Ctrl-C stops the decoding and writes the image decoded so far */
 	signal(SIGINT, sigint_handler);
 
@@ -266,6 +309,8 @@ main(int argc, char *argv[])
 	if (!quiet) printf(batch ? "\n\n" : CLR);
 	printf("MPDUs received: %d (%d lines)\n", mpdu_count, height);
 	printf("Onboard time elapsed: %s\n", mpdu_time(_last_time - _first_time));
+	printf("Sync locks: %d (lost: %d, last lock took %d CADUs)\n",
+	       decode_get_lock_count(), decode_get_unlock_count(), decode_get_lock_time());
 
 	/* If at least one line was received, write output image(s) {{{ */
 	if (height) {
@@ -477,6 +522,29 @@ write_stat_and_close(FILE *fd)
 	fclose(fd);
 }
 
+static void
+print_cpu_features()
+{
+	const uint32_t features = cpu_features();
+	unsigned int feature;
+
+	printf("CPU features:");
+	for (feature=1; feature<=CPU_NEON; feature<<=1) {
+		if (features & feature) printf(" %s", cpu_feature_name(feature));
+	}
+	printf("\n");
+
+	printf("Kernels:\n");
+	printf("  viterbi       %s\n", viterbi_kernel_name());
+	printf("  correlator    %s\n", correlator_kernel_name());
+	printf("  soft corr.    %s\n", correlator_soft_kernel_name());
+	printf("  soft_to_hard  %s\n", soft_to_hard_kernel_name());
+	printf("  derotate      %s\n", soft_derotate_kernel_name());
+	printf("  frontend      %s\n", frontend_kernel_name());
+	printf("  rs syndromes  %s\n", rs_kernel_name());
+	printf("  idct          %s\n", jpeg_kernel_name());
+}
+
 static void
 sigint_handler(int val)
 {
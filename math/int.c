@@ -8,10 +8,10 @@ int_sqrt(unsigned int x)
 	const int x2 = x >> 1;
 	int guess;
 
-	guess = 1 << ((32-__builtin_clz(x)) >> 1);
-	if (guess < 2) {
+	if (x < 2) {
 		return 0;
 	}
+	guess = 1 << ((32-__builtin_clz(x)) >> 1);
 
 	PRAGMA_UNROLL(4)
 	for (i=0; i<SQRT_PRECISION; i++) {
@@ -4,10 +4,10 @@
 #define SQRT_PRECISION 4
 
 /**
- * Fast integer square root
+ * Fast integer square root, approximated with SQRT_PRECISION Newton iterations
  *
  * @param x square root input
- * @return sqrt(x) rounded to the nearest integer
+ * @return an approximation of sqrt(x), within one of its integer part
  */
 unsigned int int_sqrt(unsigned int x);
 
@@ -2,75 +2,80 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "cpu.h"
 #include "utils.h"
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
 
 #ifndef VERSION
 #define VERSION "(unknown version)"
 #endif
 
+static void select_kernels();
+static void soft_to_hard_generic(uint8_t *restrict hard, int8_t *restrict soft, int len);
+static void soft_derotate_generic(int8_t *soft, int len, enum phase phase);
+#ifdef ARCH_X86
+TARGET_SSSE3 static void soft_to_hard_ssse3(uint8_t *restrict hard, int8_t *restrict soft, int len);
+TARGET_AVX2 static void soft_to_hard_avx2(uint8_t *restrict hard, int8_t *restrict soft, int len);
+TARGET_AVX2 static void soft_derotate_avx2(int8_t *soft, int len, enum phase phase);
+#endif
+
+/* Kernels, selected on first use based on the CPU features */
+static void (*_soft_to_hard)(uint8_t *restrict hard, int8_t *restrict soft, int len);
+static void (*_soft_derotate)(int8_t *soft, int len, enum phase phase);
+static const char *_soft_to_hard_name, *_soft_derotate_name;
+
 void
 soft_to_hard(uint8_t *restrict hard, int8_t *restrict soft, int len)
 {
-	int i;
-
-	assert(!(len & 0x7));
+	if (!_soft_to_hard) select_kernels();
+	_soft_to_hard(hard, soft, len);
+}
 
-	while (len > 0) {
-		*hard = 0;
+void
+soft_derotate(int8_t *soft, int len, enum phase phase)
+{
+	if (!_soft_derotate) select_kernels();
+	_soft_derotate(soft, len, phase);
+}
 
-		for (i=7; i>=0; i--) {
-			*hard |= (*soft < 0) << i;
-			soft++;
-		}
+/* Undoing a PHASE_INV_* rotation is the same as undoing the corresponding
+ * PHASE_* rotation and then swapping I and Q. Swapping I and Q turns a rotation
+ * into the opposite one, so combining two rotations boils down to adding or
+ * subtracting their angles and counting the swaps */
+enum phase
+phase_combine(enum phase first, enum phase second)
+{
+	const int swap = (first ^ second) & PHASE_INV_0;
+	const int angle = first & PHASE_INV_0 ? first - second : first + second;
 
-		hard++;
-		len -= 8;
-	}
+	return swap | (angle & 0x3);
 }
 
-void
-soft_derotate(int8_t *soft, int len, enum phase phase)
+enum phase
+phase_residual(enum phase done, enum phase total)
 {
-	int8_t tmp;
+	const int swap = (done ^ total) & PHASE_INV_0;
+	const int angle = done & PHASE_INV_0 ? done - total : total - done;
 
-	/* Prevent overflows when changing sign */
-	for (int i=0; i<len; i++){
-		soft[i] = MAX(-127, soft[i]);
-	}
+	return swap | (angle & 0x3);
+}
 
-	switch (phase) {
-		case PHASE_0:
-			break;
-		case PHASE_270:
-			/* (x, y) -> (-y, x) */
-			for (; len>0; len-=2) {
-				tmp = *soft;
-				*soft = -*(soft+1);
-				*(soft+1) = tmp;
-				soft += 2;
-			}
-			break;
-		case PHASE_180:
-			/* (x, y) -> (-x, -y) */
-			for (; len>0; len--) {
-				*soft = -*soft;
-				soft++;
-			}
-			break;
-		case PHASE_90:
-			/* (x, y) -> (y, -x) */
-			for (; len>0; len-=2) {
-				tmp = *soft;
-				*soft = *(soft+1);
-				*(soft+1) = -tmp;
-				soft += 2;
-			}
-			break;
-		default:
-			assert(0);
-			break;
-	}
+const char*
+soft_to_hard_kernel_name()
+{
+	if (!_soft_to_hard) select_kernels();
+	return _soft_to_hard_name;
+}
+
+const char*
+soft_derotate_kernel_name()
+{
+	if (!_soft_derotate) select_kernels();
+	return _soft_derotate_name;
 }
 
 int
@@ -103,6 +108,10 @@ usage(char *execname)
 	        "   -s, --split            Write each APID in a separate file\n"
 	        "   -t, --statfile         Write .stat file\n"
 	        "\n"
+	        "       --int8-viterbi     Use faster 8-bit Viterbi metrics (slightly less sensitive)\n"
+	        "       --soft-sync        Use soft-decision syncword correlation (slower, fewer false locks)\n"
+	        "       --acquire <n>      Accumulate up to <n> CADUs to find the syncword (faster lock on weak signals)\n"
+	        "       --cpu-features     Print the CPU features and the selected SIMD kernels\n"
 	        "   -h, --help             Print this help screen\n"
 	        "   -v, --version          Print version information\n"
 		   );
@@ -139,3 +148,204 @@ gen_fname(char *buf, size_t len)
 
 	strftime(buf, len, "LRPT_%Y_%m_%d-%H_%M.bmp", tm);
 }
+
+/* Static functions {{{ */
+static void
+select_kernels()
+{
+	_soft_to_hard = soft_to_hard_generic;
+	_soft_to_hard_name = "generic";
+	_soft_derotate = soft_derotate_generic;
+	_soft_derotate_name = "generic";
+
+#ifdef ARCH_X86
+	if (cpu_features() & CPU_SSSE3) {
+		_soft_to_hard = soft_to_hard_ssse3;
+		_soft_to_hard_name = "ssse3";
+	}
+	if (cpu_features() & CPU_AVX2) {
+		_soft_to_hard = soft_to_hard_avx2;
+		_soft_to_hard_name = "avx2";
+		_soft_derotate = soft_derotate_avx2;
+		_soft_derotate_name = "avx2";
+	}
+#endif
+}
+
+static void
+soft_to_hard_generic(uint8_t *restrict hard, int8_t *restrict soft, int len)
+{
+	int i;
+
+	assert(!(len & 0x7));
+
+	while (len > 0) {
+		*hard = 0;
+
+		for (i=7; i>=0; i--) {
+			*hard |= (*soft < 0) << i;
+			soft++;
+		}
+
+		hard++;
+		len -= 8;
+	}
+}
+
+static void
+soft_derotate_generic(int8_t *soft, int len, enum phase phase)
+{
+	int8_t tmp;
+
+	/* Prevent overflows when changing sign */
+	for (int i=0; i<len; i++){
+		soft[i] = MAX(-127, soft[i]);
+	}
+
+	switch (phase) {
+		case PHASE_0:
+			break;
+		case PHASE_270:
+			/* (x, y) -> (-y, x) */
+			for (; len>0; len-=2) {
+				tmp = *soft;
+				*soft = -*(soft+1);
+				*(soft+1) = tmp;
+				soft += 2;
+			}
+			break;
+		case PHASE_180:
+			/* (x, y) -> (-x, -y) */
+			for (; len>0; len--) {
+				*soft = -*soft;
+				soft++;
+			}
+			break;
+		case PHASE_90:
+			/* (x, y) -> (y, -x) */
+			for (; len>0; len-=2) {
+				tmp = *soft;
+				*soft = *(soft+1);
+				*(soft+1) = -tmp;
+				soft += 2;
+			}
+			break;
+		case PHASE_INV_0:
+			/* (x, y) -> (y, x) */
+			for (; len>0; len-=2) {
+				tmp = *soft;
+				*soft = *(soft+1);
+				*(soft+1) = tmp;
+				soft += 2;
+			}
+			break;
+		case PHASE_INV_270:
+			/* (x, y) -> (x, -y) */
+			for (; len>0; len-=2) {
+				*(soft+1) = -*(soft+1);
+				soft += 2;
+			}
+			break;
+		case PHASE_INV_180:
+			/* (x, y) -> (-y, -x) */
+			for (; len>0; len-=2) {
+				tmp = *soft;
+				*soft = -*(soft+1);
+				*(soft+1) = -tmp;
+				soft += 2;
+			}
+			break;
+		case PHASE_INV_90:
+			/* (x, y) -> (-x, y) */
+			for (; len>0; len-=2) {
+				*soft = -*soft;
+				soft += 2;
+			}
+			break;
+		default:
+			assert(0);
+			break;
+	}
+}
+
+#ifdef ARCH_X86
+TARGET_SSSE3 static void
+soft_to_hard_ssse3(uint8_t *restrict hard, int8_t *restrict soft, int len)
+{
+	/* Reverse the samples inside each byte, so that the first one ends up in
+	 * the MSB after the sign bits are collected */
+	const __m128i reverse = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	uint16_t bits;
+	__m128i vec;
+
+	for (; len >= 16; len -= 16) {
+		vec = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)soft), reverse);
+		bits = _mm_movemask_epi8(vec);
+		memcpy(hard, &bits, sizeof(bits));
+
+		soft += 16;
+		hard += 2;
+	}
+
+	soft_to_hard_generic(hard, soft, len);
+}
+
+TARGET_AVX2 static void
+soft_to_hard_avx2(uint8_t *restrict hard, int8_t *restrict soft, int len)
+{
+	const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+	                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	uint32_t bits;
+	__m256i vec;
+
+	for (; len >= 32; len -= 32) {
+		vec = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i*)soft), reverse);
+		bits = _mm256_movemask_epi8(vec);
+		memcpy(hard, &bits, sizeof(bits));
+
+		soft += 32;
+		hard += 4;
+	}
+
+	soft_to_hard_generic(hard, soft, len);
+}
+
+TARGET_AVX2 static void
+soft_derotate_avx2(int8_t *soft, int len, enum phase phase)
+{
+	const __m256i swap_iq = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+	                                         1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	const __m256i min_val = _mm256_set1_epi8(-127);
+	__m256i vec, sign;
+
+	/* Same transformations as the generic implementation, expressed as an
+	 * optional I/Q swap followed by a sign change on each sample */
+	switch (phase) {
+		case PHASE_0:       sign = _mm256_set1_epi8(1); break;
+		case PHASE_90:      sign = _mm256_set1_epi16(0xFF01); break;     /* (x, y) -> (y, -x) */
+		case PHASE_180:     sign = _mm256_set1_epi8(-1); break;          /* (x, y) -> (-x, -y) */
+		case PHASE_270:     sign = _mm256_set1_epi16(0x01FF); break;     /* (x, y) -> (-y, x) */
+		case PHASE_INV_0:   sign = _mm256_set1_epi8(1); break;           /* (x, y) -> (y, x) */
+		case PHASE_INV_90:  sign = _mm256_set1_epi16(0x01FF); break;     /* (x, y) -> (-x, y) */
+		case PHASE_INV_180: sign = _mm256_set1_epi8(-1); break;          /* (x, y) -> (-y, -x) */
+		case PHASE_INV_270: sign = _mm256_set1_epi16(0xFF01); break;     /* (x, y) -> (x, -y) */
+		default:
+			assert(0);
+			return;
+	}
+
+	for (; len >= 32; len -= 32) {
+		vec = _mm256_max_epi8(_mm256_loadu_si256((__m256i*)soft), min_val);
+		if (phase == PHASE_90 || phase == PHASE_270 || phase == PHASE_INV_0 || phase == PHASE_INV_180) {
+			vec = _mm256_shuffle_epi8(vec, swap_iq);
+		}
+		vec = _mm256_sign_epi8(vec, sign);
+		_mm256_storeu_si256((__m256i*)soft, vec);
+
+		soft += 32;
+	}
+
+	soft_derotate_generic(soft, len, phase);
+}
+#endif
+/* }}} */
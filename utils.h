@@ -20,8 +20,10 @@
 #define PRAGMA_UNROLL(x) DO_PRAGMA(unroll x)
 #endif
 
+/* Phase ambiguities of the QPSK constellation. The PHASE_INV_* ones are the
+ * rotations of the constellation with I and Q swapped */
 enum phase {
-	PHASE_0=0, PHASE_90=1, PHASE_180=2, PHASE_270=3, // TODO might also need I<->Q swaps?
+	PHASE_0=0, PHASE_90=1, PHASE_180=2, PHASE_270=3,
 	PHASE_INV_0=4, PHASE_INV_90=5, PHASE_INV_180=6, PHASE_INV_270=7
 };
 
@@ -36,7 +38,8 @@ enum phase {
 void     soft_to_hard(uint8_t *hard, int8_t *soft, int len);
 
 /**
- * Undo a rotation on a set of soft samples.
+ * Undo a rotation on a set of soft samples. For the PHASE_INV_* rotations, I
+ * and Q are also swapped back after undoing the rotation
  *
  * @param soft the samples to rotate in-place
  * @param len number of samples to rotate
@@ -44,6 +47,36 @@ void     soft_to_hard(uint8_t *hard, int8_t *soft, int len);
  */
 void     soft_derotate(int8_t *soft, int len, enum phase phase);
 
+/**
+ * Combine two rotations
+ *
+ * @param first the rotation undone first
+ * @param second the rotation undone second
+ * @return the rotation that, once undone, has the same effect as undoing first
+ *         and then second
+ */
+enum phase phase_combine(enum phase first, enum phase second);
+
+/**
+ * Get the rotation that is left to undo on samples that have already been
+ * derotated
+ *
+ * @param done the rotation that was already undone
+ * @param total the rotation that should have been undone
+ * @return the rotation that, once undone after done, has the same effect as
+ *         undoing total
+ */
+enum phase phase_residual(enum phase done, enum phase total);
+
+/**
+ * Get the name of the kernels used by soft_to_hard() and soft_derotate(),
+ * selected at runtime based on the CPU features
+ *
+ * @return a string describing the kernel
+ */
+const char *soft_to_hard_kernel_name();
+const char *soft_derotate_kernel_name();
+
 /**
  * Count bits set inside of a variable
  *